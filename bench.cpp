@@ -0,0 +1,700 @@
+#include <cstdio>
+#include <cstring>
+#include <cassert>
+#include <cstdint>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <time.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "opencl_backend.hpp"
+#include "perf_stats.hpp"
+#include "tuning_db.hpp"
+
+void usage() {
+  fprintf(
+    stderr,
+    "  chungus-bench [ -d <device ids>              ]\n"
+    "                [ -p <platform id>             ]\n"
+    "                [ -k <kernel location>         ]\n"
+    "                [ -l <local work size>         ]\n"
+    "                [ -w <work set size>           ]\n"
+    "                [ -T <host thread counts>      ]\n"
+    "                [ -D <active device counts>    ]\n"
+    "                [ -P <launch depths>           ]\n"
+    "                [ -G <global work sizes>       ]\n"
+    "                [ -s <seconds per point>       ]\n"
+    "                [ -o <csv file>                ]\n"
+    "                [ -f <header file>             ]\n"
+    "                [ -V <kernel variant>          ]\n"
+    "  chungus-bench -A [ -d ... ] [ -p ... ] [ -k ... ] [ -G ... ] [ -s ... ]\n"
+    "                   [ -V <kernel variants>      ]\n"
+    "                   [ -L <local work sizes>     ]\n"
+    "                   [ -W <work set sizes>       ]\n"
+    "  chungus-bench -O [ -d ... ] [ -p ... ] [ -k ... ] [ -l ... ] [ -w ... ]\n"
+    "                   [ -G ... ] [ -s ... ] [ -V ... ] [ -o ... ]\n"
+    "  chungus-bench -Q [ -d ... ] [ -p ... ] [ -k ... ] [ -l ... ] [ -w ... ]\n"
+    "                   [ -G ... ] [ -s ... ] [ -V ... ] [ -o ... ]\n"
+    "  chungus-bench -C [ -T ... ] [ -o ... ]\n\n"
+    "  Sweeps every combination of host threads, active devices, launches in\n"
+    "  flight per thread and global work size against an unreachable target, and\n"
+    "  reports throughput, host CPU use, launch latency and scaling efficiency.\n\n"
+    "  All list arguments are comma separated, e.g. `-T 1,2,4,8`.\n\n"
+    "    -d <device ids>\n"
+    "      Devices to use, in the order they are activated. Default `0`\n\n"
+    "    -T <host thread counts>\n"
+    "      Host threads submitting launches. Thread t drives active device t %% D.\n"
+    "      Default `1,2,4`\n\n"
+    "    -D <active device counts>\n"
+    "      Default: 1 up to the number of devices given with -d, doubling.\n\n"
+    "    -P <launch depths>\n"
+    "      Launches each thread keeps in flight. Default `1,2,4`\n\n"
+    "    -G <global work sizes>\n"
+    "      Default `4194304,16777216`\n\n"
+    "    -s <seconds per point>\n"
+    "      Default `5`\n\n"
+    "    -f <header file>\n"
+    "      Default `test/header.bin`\n\n"
+    "    -V <kernel variant>\n"
+    "      `unrolled` (default), `compact`, `nonce32` or `compact-nonce32`.\n\n"
+    "  With -A, tunes every distinct device model given with -d instead: each\n"
+    "  kernel variant is built at each work set size, its compile time and code\n"
+    "  size are recorded, and it is timed at each local and global work size. The fastest\n"
+    "  combination is stored in the tuning database ($BIGOLCHUNGUS_TUNING_DB, or\n"
+    "  ~/.cache/bigolchungus/tuning.db), where `-V tuned` picks it up.\n\n"
+    "    -V <kernel variants>\n"
+    "      Default `unrolled,compact,nonce32,compact-nonce32`\n\n"
+    "    -L <local work sizes>\n"
+    "      Default `64,128,256,512,1024`, capped at what the kernel supports.\n\n"
+    "    -W <work set sizes>\n"
+    "      Default `32,64,128`\n\n"
+    "  With -O, measures the launch overhead of each device given with -d instead:\n"
+    "  an empty kernel of each global work size is launched for -s seconds with\n"
+    "  the blocking sequence of the miner (write, NDRange, read), with two launches\n"
+    "  in flight, through a mapped result buffer, and replayed from a command\n"
+    "  buffer where the device has cl_khr_command_buffer. For each it reports the\n"
+    "  distribution of the cost per launch, the share of the hashrate that cost\n"
+    "  takes from the search kernel at that global work size, and the smallest\n"
+    "  global work size that keeps it under 1%%.\n\n"
+    "  With -Q, reports the occupancy of each device given with -d instead: the\n"
+    "  work groups its compute units run at once (a wave), how full the last wave\n"
+    "  of a launch of each global work size is, and the hashrate at that size next\n"
+    "  to the hashrate at the whole number of waves the miner rounds it to. Sizes\n"
+    "  are first rounded up to whole work groups of the local size.\n\n"
+    "  With -C, measures the cost of a perf_stats update (a counter or a histogram\n"
+    "  sample) from each number of threads given with -T, default `1,2,4,...,64`,\n"
+    "  all updating at once, next to the same updates on shared atomics. Costs\n"
+    "  are thread CPU time, so they stay meaningful with more threads than cores.\n"
+    "  Needs no device.\n\n"
+  );
+}
+
+struct bench_point {
+    size_t threads;
+    size_t devices;
+    size_t depth;
+    size_t global_size;
+
+    uint64_t hashes;
+    double seconds;
+    double cpu_seconds;
+    double latency_avg_ms;
+    double latency_p99_ms;
+
+    double hashrate() const { return hashes / seconds; }
+};
+
+double cpu_time() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6
+        + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+// Runs one sweep point. Thread t drives device t % point.devices through its
+// own lane, lane (t / point.devices) of that device.
+void run_point(opencl_backend& backend, size_t device_count, size_t workset_size, double seconds, bench_point& point) {
+    std::atomic<bool> stop(false);
+    std::vector<uint64_t> hashes(point.threads, 0);
+    std::vector<std::vector<double> > latencies(point.threads);
+
+    auto worker = [&](size_t t) {
+        size_t lane = (t / point.devices) * device_count + t % point.devices;
+        uint64_t step = point.global_size * workset_size;
+        uint64_t nonce = (uint64_t) t << 48;
+
+        std::vector<std::chrono::high_resolution_clock::time_point> issued(point.depth);
+        // Latency runs from the end of enqueue_search to the end of wait_search.
+        for (size_t slot = 0; slot < point.depth; slot++) {
+            backend.enqueue_search(nonce, lane, slot, point.global_size);
+            issued[slot] = std::chrono::high_resolution_clock::now();
+            nonce += step;
+        }
+
+        for (size_t slot = 0; !stop; slot = (slot + 1) % point.depth) {
+            backend.wait_search(lane, slot);
+            auto now = std::chrono::high_resolution_clock::now();
+            latencies[t].push_back(std::chrono::duration<double, std::milli>(now - issued[slot]).count());
+            hashes[t] += step;
+
+            backend.enqueue_search(nonce, lane, slot, point.global_size);
+            issued[slot] = std::chrono::high_resolution_clock::now();
+            nonce += step;
+        }
+
+        // Drain, without counting launches that complete after the deadline.
+        for (size_t slot = 0; slot < point.depth; slot++) backend.wait_search(lane, slot);
+    };
+
+    double cpu_start = cpu_time();
+    auto t_start = std::chrono::high_resolution_clock::now();
+
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < point.threads; t++) threads.push_back(std::thread(worker, t));
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    stop = true;
+    auto t_end = std::chrono::high_resolution_clock::now();
+    for (std::thread& thread : threads) thread.join();
+
+    point.seconds = std::chrono::duration<double>(t_end - t_start).count();
+    point.cpu_seconds = cpu_time() - cpu_start;
+    point.hashes = 0;
+    std::vector<double> all;
+    for (size_t t = 0; t < point.threads; t++) {
+        point.hashes += hashes[t];
+        all.insert(all.end(), latencies[t].begin(), latencies[t].end());
+    }
+    std::sort(all.begin(), all.end());
+    point.latency_avg_ms = 0;
+    for (double l : all) point.latency_avg_ms += l;
+    point.latency_avg_ms = all.empty() ? 0 : point.latency_avg_ms / all.size();
+    point.latency_p99_ms = all.empty() ? 0 : all[std::min(all.size() - 1, all.size() * 99 / 100)];
+}
+
+std::vector<size_t> parse_size_list(const char* str) {
+    std::vector<size_t> result;
+    for (int v : parse_int_list(str)) result.push_back(v);
+    return result;
+}
+
+std::vector<std::string> parse_string_list(const char* str) {
+    std::vector<std::string> result;
+    std::string item;
+    for (const char* c = str; ; c++) {
+        if (*c == ',' || *c == '\0') {
+            if (!item.empty()) result.push_back(item);
+            item.clear();
+            if (*c == '\0') break;
+        } else {
+            item += *c;
+        }
+    }
+    return result;
+}
+
+// The sorted `samples` at fraction `p`.
+double percentile(const std::vector<double>& samples, double p) {
+    return samples.empty() ? 0 : samples[std::min(samples.size() - 1, (size_t) (samples.size() * p))];
+}
+
+// Runs continue_search launches of `global_size` on `device` for `seconds` and
+// returns the time per launch in ms, counting them in `launches`.
+double time_search(
+    opencl_backend& backend, size_t device, size_t global_size, size_t workSetSize, double seconds,
+    size_t& launches
+) {
+    backend.continue_search(0, device, global_size);
+    launches = 0;
+    auto t_start = std::chrono::high_resolution_clock::now();
+    double elapsed = 0;
+    for (uint64_t nonce = 0; elapsed < seconds; launches++) {
+        nonce += (uint64_t) global_size * workSetSize;
+        backend.continue_search(nonce, device, global_size);
+        elapsed = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - t_start).count();
+    }
+    return 1000 * elapsed / launches;
+}
+
+// Reports how full the last wave of a launch of each global size is on each
+// device of `backend`, and the hashrate at that size next to the hashrate at
+// the size the miner rounds it to.
+void tail_occupancy(
+    opencl_backend& backend, size_t workSetSize, const std::vector<size_t>& globalSizes,
+    double seconds, FILE* csv
+) {
+    if (csv != nullptr) {
+        fprintf(csv, "device,compute_units,unit_groups,wave_size,global_size,waves,tail_percent,"
+            "utilization_percent,hashrate,quantized_size,quantized_hashrate\n");
+    }
+
+    for (size_t d = 0; d < backend.devices.size(); d++) {
+        const opencl_device& device = backend.devices[d];
+        size_t wave = device.wave_size;
+        printf("Device %zu: %s\n", d, device.build_key.c_str());
+        printf("%zu compute units x %zu work groups of %zu: waves of %zu work items\n",
+            device.compute_units, device.unit_groups, device.search_nonce->local_size, wave);
+        printf("%10s %8s %7s %7s %10s %10s %10s %7s\n", "global", "waves", "tail%", "util%", "MH/s",
+            "quantized", "MH/s", "gain%");
+
+        size_t local = device.search_nonce->local_size;
+        for (size_t global_size : globalSizes) {
+            // A launch must be whole work groups.
+            if (global_size % local != 0) {
+                size_t rounded = (global_size + local - 1) / local * local;
+                printf("%10zu is not a multiple of the local size %zu, using %zu\n", global_size, local, rounded);
+                global_size = rounded;
+            }
+            size_t waves = (global_size + wave - 1) / wave;
+            double tail = global_size % wave == 0 ? 100 : 100.0 * (global_size % wave) / wave;
+            double utilization = 100.0 * global_size / (waves * wave);
+
+            size_t launches = 0;
+            double rate = global_size * workSetSize
+                / time_search(backend, d, global_size, workSetSize, seconds, launches) / 1e3;
+            size_t quantized = backend.quantize_global_size(d, global_size);
+            double quantized_rate = quantized * workSetSize
+                / time_search(backend, d, quantized, workSetSize, seconds, launches) / 1e3;
+
+            printf("%10zu %8.2f %6.1f%% %6.1f%% %10.2f %10zu %10.2f %6.2f%%\n",
+                global_size, (double) global_size / wave, tail, utilization, rate,
+                quantized, quantized_rate, 100 * (quantized_rate / rate - 1));
+            if (csv != nullptr) {
+                fprintf(csv, "\"%s\",%zu,%zu,%zu,%zu,%.3f,%.2f,%.2f,%.3f,%zu,%.3f\n",
+                    device.build_key.c_str(), device.compute_units, device.unit_groups, wave, global_size,
+                    (double) global_size / wave, tail, utilization, rate, quantized, quantized_rate);
+            }
+        }
+        printf("\n");
+    }
+}
+
+// CPU time of the calling thread.
+double thread_cpu_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+void stats_overhead(const std::vector<size_t>& threadCounts, FILE* csv) {
+    // Two updates per iteration: a counter and a histogram sample.
+    const size_t ITERATIONS = 1 << 22;
+    std::atomic<uint64_t> shared_counter(0);
+    std::vector<std::atomic<uint64_t> > shared_buckets(PERF_BUCKETS);
+    for (std::atomic<uint64_t>& bucket : shared_buckets) bucket = 0;
+
+    if (csv != nullptr) fprintf(csv, "threads,perf_stats_ns,shared_atomic_ns\n");
+    printf("%8s %16s %16s\n", "threads", "perf_stats ns", "shared atomic ns");
+    for (size_t threads : threadCounts) {
+        double cost[2];
+        for (int shared = 0; shared < 2; shared++) {
+            std::vector<double> ns(threads);
+            auto worker = [&](size_t t) {
+                double t_start = thread_cpu_ns();
+                for (size_t i = 0; i < ITERATIONS; i++) {
+                    uint64_t sample = (i * 7919) & 0xFFFFF;
+                    if (shared) {
+                        shared_counter.fetch_add(64, std::memory_order_relaxed);
+                        shared_buckets[perf_bucket(sample)].fetch_add(1, std::memory_order_relaxed);
+                    } else {
+                        perf_count(PERF_HASHES, 64);
+                        perf_record(PERF_LAUNCH_NS, sample);
+                    }
+                }
+                ns[t] = thread_cpu_ns() - t_start;
+            };
+            std::vector<std::thread> workers;
+            for (size_t t = 0; t < threads; t++) workers.push_back(std::thread(worker, t));
+            for (std::thread& w : workers) w.join();
+
+            double total = 0;
+            for (double thread_ns : ns) total += thread_ns;
+            cost[shared] = total / (threads * ITERATIONS * 2.0);
+        }
+        printf("%8zu %16.2f %16.2f\n", threads, cost[0], cost[1]);
+        if (csv != nullptr) fprintf(csv, "%zu,%.3f,%.3f\n", threads, cost[0], cost[1]);
+    }
+}
+
+// Measures the launch overhead of each device of `backend` against the time
+// the search kernel takes per launch at each global size.
+void launch_overhead(
+    opencl_backend& backend, size_t localWorkSize, size_t workSetSize,
+    const std::vector<size_t>& globalSizes, double seconds, FILE* csv
+) {
+    const char* modeNames[] = {"blocking", "pipelined", "mapped", "recorded"};
+    const launch_mode modes[] = {LAUNCH_BLOCKING, LAUNCH_PIPELINED, LAUNCH_MAPPED, LAUNCH_RECORDED};
+
+    if (csv != nullptr) {
+        fprintf(csv, "device,global_size,mode,launches,mean_ms,min_ms,p50_ms,p90_ms,p99_ms,max_ms,"
+            "kernel_ms,loss_percent,min_global_size\n");
+    }
+
+    for (size_t d = 0; d < backend.devices.size(); d++) {
+        std::string device = backend.devices[d].build_key;
+        printf("Device %zu: %s\n", d, device.c_str());
+        printf("%10s %10s %9s %9s %9s %9s %9s %9s %9s %7s %12s\n", "global", "mode", "launches",
+            "mean ms", "min ms", "p50 ms", "p90 ms", "p99 ms", "max ms", "loss%", "min -g");
+
+        for (size_t global_size : globalSizes) {
+            // The search kernel at this size, with the overhead of a blocking launch.
+            size_t launches = 0;
+            double search_ms = time_search(backend, d, global_size, workSetSize, seconds, launches);
+            // continue_search replays a command buffer where the device allows.
+            launch_mode searchMode = backend.devices[d].search_nonce->recording != nullptr
+                ? LAUNCH_RECORDED : LAUNCH_BLOCKING;
+
+            std::vector<double> modeSamples[4];
+            double kernel_ms = 0;
+            for (size_t m = 0; m < 4; m++) {
+                modeSamples[m] = backend.time_empty_launches(d, modes[m], global_size, localWorkSize, seconds);
+                std::sort(modeSamples[m].begin(), modeSamples[m].end());
+                if (modes[m] == searchMode && !modeSamples[m].empty()) {
+                    double mean = 0;
+                    for (double sample : modeSamples[m]) mean += sample;
+                    kernel_ms = std::max(0.0, search_ms - mean / modeSamples[m].size());
+                }
+            }
+
+            for (size_t m = 0; m < 4; m++) {
+                const std::vector<double>& samples = modeSamples[m];
+                if (samples.empty()) {
+                    printf("%10zu %10s   (no cl_khr_command_buffer)\n", global_size, modeNames[m]);
+                    continue;
+                }
+                double mean = 0;
+                for (double sample : samples) mean += sample;
+                mean /= samples.size();
+
+                // The launch cost is idle time of the device between kernels,
+                // at most; pipelining hides part of it behind the kernel.
+                double loss = mean / (kernel_ms + mean);
+                size_t min_global = 0;
+                if (kernel_ms > 0) {
+                    double item_ms = kernel_ms / global_size;
+                    min_global = (size_t) (99 * mean / item_ms);
+                    min_global = (min_global / localWorkSize + 1) * localWorkSize;
+                }
+
+                printf("%10zu %10s %9zu %9.4f %9.4f %9.4f %9.4f %9.4f %9.4f %6.2f%% %12zu\n",
+                    global_size, modeNames[m], samples.size(), mean, samples[0],
+                    percentile(samples, 0.5), percentile(samples, 0.9), percentile(samples, 0.99),
+                    samples.back(), 100 * loss, min_global);
+                if (csv != nullptr) {
+                    fprintf(csv, "\"%s\",%zu,%s,%zu,%.5f,%.5f,%.5f,%.5f,%.5f,%.5f,%.4f,%.3f,%zu\n",
+                        device.c_str(), global_size, modeNames[m], samples.size(), mean, samples[0],
+                        percentile(samples, 0.5), percentile(samples, 0.9), percentile(samples, 0.99),
+                        samples.back(), kernel_ms, 100 * loss, min_global);
+                }
+            }
+            printf("%10zu %10s %9zu %9.4f   (search kernel, %.2f MH/s)\n", global_size, "search", launches,
+                search_ms, global_size * workSetSize / search_ms / 1e3);
+        }
+        printf("\n");
+    }
+}
+
+struct tune_point {
+    std::string variant;
+    size_t workset_size;
+    size_t local_size;
+    size_t global_size;
+    double compile_ms;
+    size_t binary_bytes;
+    size_t instructions;
+    double hashrate;
+};
+
+// Tunes each distinct device model in `deviceIds` and stores the fastest
+// variant and work sizes in the tuning database.
+void autotune(
+    const std::vector<int>& deviceIds, int platformOverride, char* kernelPath,
+    const std::vector<std::string>& variants, const std::vector<size_t>& worksetSizes,
+    const std::vector<size_t>& localSizes, const std::vector<size_t>& globalSizes,
+    double seconds, FILE* csv, uint8_t* buf, uint8_t* target_hash
+) {
+    std::string dbPath = tuning_db_path();
+    std::vector<std::string> tuned;
+
+    if (csv != nullptr) {
+        fprintf(csv, "device,variant,workset_size,local_size,global_size,compile_ms,binary_bytes,instructions,hashrate\n");
+    }
+
+    for (int deviceId : deviceIds) {
+        opencl_backend backend(0, true, std::vector<int>(1, deviceId), platformOverride, kernelPath);
+        std::string device = backend.devices[0].build_key;
+        if (std::find(tuned.begin(), tuned.end(), device) != tuned.end()) continue;
+        tuned.push_back(device);
+        fprintf(stderr, "Tuning device %d: %s\n", deviceId, device.c_str());
+
+        std::vector<tune_point> points;
+        for (const std::string& variant : variants) {
+            if (!backend.set_kernel_variant(variant)) {
+                fprintf(stderr, "Unknown kernel variant %s\n", variant.c_str());
+                exit(1);
+            }
+            for (size_t workset_size : worksetSizes) {
+                backend.start_search(globalSizes[0], localSizes[0], workset_size, buf, target_hash);
+                backend.set_pipeline_depth(2);
+                double compile_ms = backend.build_ms;
+                size_t binary_bytes = backend.build_bytes;
+                size_t instructions = backend.build_instructions;
+
+                size_t maxLocal = 0;
+                clGetKernelWorkGroupInfo(
+                    backend.devices[0].search_nonce->kernel, backend.devices[0].device_id,
+                    CL_KERNEL_WORK_GROUP_SIZE, sizeof(maxLocal), &maxLocal, nullptr);
+
+                for (size_t local_size : localSizes) {
+                    if (local_size > maxLocal) continue;
+                    backend.devices[0].search_nonce->local_size = local_size;
+                    backend.enqueue_search(0, 0, 0, local_size);
+                    backend.wait_search(0, 0);
+
+                    for (size_t global_size : globalSizes) {
+                        if (global_size % local_size != 0) continue;
+                        bench_point point = {};
+                        point.threads = 1;
+                        point.devices = 1;
+                        point.depth = 2;
+                        point.global_size = global_size;
+                        run_point(backend, 1, workset_size, seconds, point);
+
+                        tune_point tp = {
+                            variant, workset_size, local_size, global_size,
+                            compile_ms, binary_bytes, instructions, point.hashrate() };
+                        fprintf(stderr, "%s workset=%zu local=%zu global=%zu: %.2f MH/s (built in %.0f ms)\n",
+                            variant.c_str(), workset_size, local_size, global_size, tp.hashrate / 1e6, compile_ms);
+                        if (csv != nullptr) {
+                            fprintf(csv, "\"%s\",%s,%zu,%zu,%zu,%.1f,%zu,%zu,%.0f\n", device.c_str(), variant.c_str(),
+                                workset_size, local_size, global_size, compile_ms, binary_bytes, instructions, tp.hashrate);
+                        }
+                        points.push_back(tp);
+                    }
+                }
+                backend.stop_search();
+            }
+        }
+        if (points.empty()) continue;
+
+        printf("%s\n", device.c_str());
+        // Instruction counts are only known for PTX; other drivers hand out
+        // opaque binaries, whose size is the next best measure of code size.
+        printf("%16s %8s %6s %10s %12s %12s %10s %8s\n",
+            "variant", "workset", "local", "global", "MH/s", "compile ms", "binary KB", "instr");
+        const tune_point* best = &points[0];
+        for (const tune_point& tp : points) {
+            printf("%16s %8zu %6zu %10zu %12.2f %12.0f %10.1f %8zu\n", tp.variant.c_str(), tp.workset_size,
+                tp.local_size, tp.global_size, tp.hashrate / 1e6, tp.compile_ms,
+                tp.binary_bytes / 1024.0, tp.instructions);
+            if (tp.hashrate > best->hashrate) best = &tp;
+        }
+
+        tuning_entry entry = {
+            device, best->variant, best->local_size, best->workset_size,
+            best->global_size, best->hashrate, best->compile_ms };
+        if (!store_tuning_entry(dbPath, entry)) {
+            fprintf(stderr, "Cannot write %s\n", dbPath.c_str());
+            exit(1);
+        }
+        printf("Best: -V %s -l %zu -w %zu -g %zu (%.2f MH/s), stored in %s\n\n",
+            best->variant.c_str(), best->local_size, best->workset_size, best->global_size,
+            best->hashrate / 1e6, dbPath.c_str());
+    }
+}
+
+int main(int argc, char* const* argv) {
+    std::vector<int> deviceIds(1, 0);
+    int platformOverride = -1;
+    char* kernelPath = nullptr;
+    size_t localWorkSize = 256;
+    size_t workSetSize = 64;
+    std::vector<size_t> threadCounts = {1, 2, 4};
+    std::vector<size_t> deviceCounts;
+    std::vector<size_t> depths = {1, 2, 4};
+    std::vector<size_t> globalSizes = {1024 * 1024 * 4, 1024 * 1024 * 16};
+    double seconds = 5;
+    const char* csvPath = nullptr;
+    const char* headerPath = "test/header.bin";
+    bool tune = false;
+    bool overhead = false;
+    bool occupancy = false;
+    bool counters = false;
+    bool threadsGiven = false;
+    std::vector<std::string> variants;
+    std::vector<size_t> localSizes = {64, 128, 256, 512, 1024};
+    std::vector<size_t> worksetSizes = {32, 64, 128};
+
+    int opt;
+    while ((opt = getopt(argc, argv, "d:p:k:l:w:T:D:P:G:s:o:f:AOQCV:L:W:h")) != -1) {
+      switch(opt) {
+        case 'd': deviceIds = parse_int_list(optarg); break;
+        case 'p': platformOverride = std::stoi(optarg); break;
+        case 'k': kernelPath = optarg; break;
+        case 'l': localWorkSize = std::stoi(optarg); break;
+        case 'w': workSetSize = std::stoi(optarg); break;
+        case 'T': threadCounts = parse_size_list(optarg); threadsGiven = true; break;
+        case 'D': deviceCounts = parse_size_list(optarg); break;
+        case 'P': depths = parse_size_list(optarg); break;
+        case 'G': globalSizes = parse_size_list(optarg); break;
+        case 's': seconds = std::stod(optarg); break;
+        case 'o': csvPath = optarg; break;
+        case 'f': headerPath = optarg; break;
+        case 'A': tune = true; break;
+        case 'O': overhead = true; break;
+        case 'Q': occupancy = true; break;
+        case 'C': counters = true; break;
+        case 'V': variants = parse_string_list(optarg); break;
+        case 'L': localSizes = parse_size_list(optarg); break;
+        case 'W': worksetSizes = parse_size_list(optarg); break;
+        case 'h':
+        case '?':
+          usage();
+          exit(1);
+      }
+    }
+
+    if (counters) {
+        if (!threadsGiven) threadCounts = {1, 2, 4, 8, 16, 32, 64};
+        FILE* csv = csvPath != nullptr ? fopen(csvPath, "w") : nullptr;
+        stats_overhead(threadCounts, csv);
+        if (csv != nullptr) fclose(csv);
+        return 0;
+    }
+
+    if (deviceCounts.empty()) {
+        for (size_t d = 1; d < deviceIds.size(); d *= 2) deviceCounts.push_back(d);
+        deviceCounts.push_back(deviceIds.size());
+    }
+
+    uint8_t buf[320] = {0};
+    FILE* header = fopen(headerPath, "rb");
+    if (header == nullptr) {
+        fprintf(stderr, "Cannot open %s\n", headerPath);
+        exit(1);
+    }
+    size_t bufsize = fread(buf, 1, sizeof(buf), header);
+    fclose(header);
+    assert(320 - 64 + 1 <= bufsize && bufsize <= 320);
+
+    // A zero target is never met, so every launch runs to completion.
+    uint8_t target_hash[32] = {0};
+
+    if (tune) {
+        if (variants.empty()) variants = {"unrolled", "compact", "nonce32", "compact-nonce32"};
+        FILE* csv = csvPath != nullptr ? fopen(csvPath, "w") : nullptr;
+        autotune(deviceIds, platformOverride, kernelPath, variants, worksetSizes,
+            localSizes, globalSizes, seconds, csv, buf, target_hash);
+        if (csv != nullptr) fclose(csv);
+        return 0;
+    }
+
+    if (occupancy) {
+        opencl_backend backend(0, true, deviceIds, platformOverride, kernelPath);
+        if (!variants.empty() && !backend.set_kernel_variant(variants[0])) {
+            fprintf(stderr, "Unknown kernel variant %s\n", variants[0].c_str());
+            exit(1);
+        }
+        backend.start_search(globalSizes[0], localWorkSize, workSetSize, buf, target_hash);
+        FILE* csv = csvPath != nullptr ? fopen(csvPath, "w") : nullptr;
+        tail_occupancy(backend, workSetSize, globalSizes, seconds, csv);
+        if (csv != nullptr) fclose(csv);
+        return 0;
+    }
+
+    if (overhead) {
+        opencl_backend backend(0, true, deviceIds, platformOverride, kernelPath);
+        if (!variants.empty() && !backend.set_kernel_variant(variants[0])) {
+            fprintf(stderr, "Unknown kernel variant %s\n", variants[0].c_str());
+            exit(1);
+        }
+        backend.start_search(globalSizes[0], localWorkSize, workSetSize, buf, target_hash);
+        FILE* csv = csvPath != nullptr ? fopen(csvPath, "w") : nullptr;
+        launch_overhead(backend, localWorkSize, workSetSize, globalSizes, seconds, csv);
+        if (csv != nullptr) fclose(csv);
+        return 0;
+    }
+
+    size_t maxThreads = *std::max_element(threadCounts.begin(), threadCounts.end());
+    size_t maxDepth = *std::max_element(depths.begin(), depths.end());
+
+    // One lane per (device, thread) pair that any point can use.
+    std::vector<int> lanes;
+    for (size_t j = 0; j < maxThreads; j++) {
+        lanes.insert(lanes.end(), deviceIds.begin(), deviceIds.end());
+    }
+
+    opencl_backend backend(0, true, lanes, platformOverride, kernelPath);
+    if (!variants.empty() && !backend.set_kernel_variant(variants[0])) {
+        fprintf(stderr, "Unknown kernel variant %s\n", variants[0].c_str());
+        exit(1);
+    }
+    backend.start_search(globalSizes[0], localWorkSize, workSetSize, buf, target_hash);
+    backend.set_pipeline_depth(maxDepth);
+
+    // Warm up every lane so that lazy driver initialization is not measured.
+    for (size_t lane = 0; lane < lanes.size(); lane++) {
+        backend.enqueue_search(0, lane, 0, localWorkSize);
+        backend.wait_search(lane, 0);
+    }
+
+    std::vector<bench_point> points;
+    for (size_t global_size : globalSizes) {
+        for (size_t depth : depths) {
+            for (size_t devices : deviceCounts) {
+                for (size_t threads : threadCounts) {
+                    if (devices > deviceIds.size()) continue;
+                    if (threads < devices) continue;
+                    bench_point point = {};
+                    point.threads = threads;
+                    point.devices = devices;
+                    point.depth = depth;
+                    point.global_size = global_size;
+                    run_point(backend, deviceIds.size(), workSetSize, seconds, point);
+                    fprintf(stderr, "threads=%zu devices=%zu depth=%zu global=%zu: %.2f MH/s\n",
+                        threads, devices, depth, global_size, point.hashrate() / 1e6);
+                    points.push_back(point);
+                }
+            }
+        }
+    }
+
+    FILE* csv = csvPath != nullptr ? fopen(csvPath, "w") : nullptr;
+    if (csv != nullptr) {
+        fprintf(csv, "threads,devices,depth,global_size,hashrate,cpu_percent,latency_avg_ms,latency_p99_ms,efficiency\n");
+    }
+
+    printf("%7s %7s %5s %10s %12s %7s %10s %10s %10s\n",
+        "threads", "devices", "depth", "global", "MH/s", "cpu%", "lat avg", "lat p99", "efficiency");
+    for (const bench_point& point : points) {
+        // Efficiency is relative to one thread on one device with the same
+        // depth and global size, scaled by the number of active devices.
+        double base = 0;
+        for (const bench_point& other : points) {
+            if (other.threads == 1 && other.devices == 1
+                && other.depth == point.depth && other.global_size == point.global_size) {
+                base = other.hashrate();
+            }
+        }
+        double efficiency = base > 0 ? point.hashrate() / (base * point.devices) : 0;
+        double cpu = 100 * point.cpu_seconds / point.seconds;
+
+        printf("%7zu %7zu %5zu %10zu %12.2f %7.1f %10.3f %10.3f %9.1f%%\n",
+            point.threads, point.devices, point.depth, point.global_size,
+            point.hashrate() / 1e6, cpu, point.latency_avg_ms, point.latency_p99_ms, 100 * efficiency);
+        if (csv != nullptr) {
+            fprintf(csv, "%zu,%zu,%zu,%zu,%.0f,%.1f,%.4f,%.4f,%.4f\n",
+                point.threads, point.devices, point.depth, point.global_size,
+                point.hashrate(), cpu, point.latency_avg_ms, point.latency_p99_ms, efficiency);
+        }
+    }
+    if (csv != nullptr) fclose(csv);
+
+    return 0;
+}
@@ -3,66 +3,25 @@
 #include <cassert>
 #include <cstdint>
 #include <inttypes.h>
+#include <atomic>
 #include <chrono>
+#include <cmath>
+#include <fstream>
 #include <sstream>
 #include <iostream>
 #include <string>
+#include <thread>
+#include <vector>
 #include <unistd.h>
 
 #include "blake2s_ref.h"
 #include "common.h"
+#include "load_balancer.hpp"
+#include "nonce_coordinator.hpp"
 #include "opencl_backend.hpp"
-
-void usage() {
-  fprintf(
-    stderr,
-    "  bigolchungus.sh [ -d <device id>         ]\n"
-    "                  [ -p <platform id>       ]\n"
-    "                  [ -l <local work size>   ]\n"
-    "                  [ -w <work set size      ]\n"
-    "                  [ -g <global work size>  ]\n"
-    "                  [ -k <kernel location>   ]\n"
-    "                  [ -n <hexadecimal nonce> ]\n"
-    "                  [ -v                     ]\n"
-    "                  <block>\n\n"
-    "  1. Device Selection\n\n"
-    "    -d <device id>\n"
-    "      Default `0`\n\n"
-    "    -p <platform id>\n"
-    "      Default `0`\n\n"
-    "    Run `clinfo -l` to get info about your device and platform ids.\n\n"
-    "  2. Open CL work configuration \n\n"
-    "    -l <local work size> \n"
-    "      Default `256`.\n\n"
-    "      If you are on AMD, `256` is probably the best value for you.\n"
-    "      If you are on nVidia, you probably want `1024`.\n\n"
-    "    -w <work set size> \n"
-    "      Default `64`\n\n"
-    "    -g <global work size>\n"
-    "      Default `16777216` (1024 * 1024 * 16)\n\n"
-    "    -k <kernel location>\n"
-    "      If you are getting opencl error -46 or -30, try setting this to the absolute path of the `kernel.cl` file.\n"
-    "      Defaults to ./kernels/kernel.cl\n\n"
-    "  3. Debugging\n\n"
-    "    -v\n"
-    "      enable verbose mode.\n\n"
-    "  4. Advanced\n\n"
-    "    -n <hexadecimal nonce>\n"
-    "      Manually sets a nonce for hashing.\n"
-    "      In the unlikely case that your mining host provides a nonce, use this.\n"
-    "      If you are trying to get reproducible tests, use this.\n\n"
-  );
-
-}
-
-void read_target_bytes(const char* str, uint8_t* target) {
-    assert(strlen(str) == 64);
-    for (size_t i = 0; i < 32; i++) {
-        uint8_t c1 = hexchar2int(str[2 * i]);
-        uint8_t c2 = hexchar2int(str[2 * i + 1]);
-        target[i] = (c1 << 4) | c2;
-    }
-}
+#include "options.hpp"
+#include "search.hpp"
+#include "tuning_db.hpp"
 
 void ref_search_nonce(
   size_t gid,
@@ -90,6 +49,203 @@ void ref_search_nonce(
     }
 }
 
+// Hash mode: one hex message per line in, one hex digest per line out.
+int hash_stdin(const miner_options& options) {
+    // Before reading stdin: a stale device cache restarts the process.
+    opencl_backend backend(0, options.quiet, options.device_overrides, options.platform_override, options.kernel_path);
+
+    std::vector<uint8_t> data;
+    std::vector<uint32_t> offsets;
+    read_hex_messages(std::cin, data, offsets);
+    size_t count = offsets.size() - 1;
+    std::vector<uint8_t> digests(32 * count);
+
+    backend.start_hashing(16 * 1024 * 1024, 256 * 1024);
+    if (!backend.hashable(offsets.data(), count)) {
+        fprintf(stderr, "A message exceeds the hashing batch size\n");
+        exit(1);
+    }
+
+    // Each device hashes a contiguous share of the messages from a thread
+    // of its own; the digests land in place.
+    size_t device_count = backend.devices.size();
+    auto t_start = std::chrono::high_resolution_clock::now();
+    std::vector<std::thread> hashers;
+    for (size_t d = 0; d < device_count; d++) {
+        size_t first = count * d / device_count;
+        size_t last = count * (d + 1) / device_count;
+        if (first == last) continue;
+        hashers.push_back(std::thread([&, d, first, last]() {
+            backend.hash_messages(data.data(), offsets.data() + first, last - first, digests.data() + 32 * first, d);
+        }));
+    }
+    for (std::thread& hasher : hashers) hasher.join();
+    auto t_end = std::chrono::high_resolution_clock::now();
+    if (!options.quiet) fprintf(stderr, "Hashed %zu messages on %zu device(s) in %.3f ms\n",
+        count, device_count, std::chrono::duration<double, std::milli>(t_end - t_start).count());
+
+    for (size_t k = 0; k < count; k++) {
+        for (int i = 0; i < 32; i++) printf("%02x", digests[32 * k + i]);
+        printf("\n");
+    }
+    return 0;
+}
+
+struct batch_record {
+    uint8_t block[320];
+    size_t block_size;
+    uint8_t target_hash[32];
+    uint64_t start_nonce;
+    size_t global_size;   // per launch, see batch_global_size
+    uint64_t nonce;
+    uint64_t hashes;
+};
+
+// Reads the `<target> <header>` lines of a batch file. The fields may come in
+// either order, the target being the one with 64 digits, and later fields
+// are ignored, so that lines of test/corpus.txt work too.
+std::vector<batch_record> read_batch(const char* path) {
+    std::ifstream in(path);
+    if (!in) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        exit(1);
+    }
+
+    std::vector<batch_record> records;
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        std::string target, header;
+        if (line.empty() || line[0] == '#' || !(fields >> target >> header)) continue;
+        if (header.size() == 64) std::swap(target, header);
+        size_t size = header.size() / 2;
+        if (target.size() != 64 || size < 320 - 64 + 1 || size > 320) {
+            fprintf(stderr, "Malformed batch line: %s\n", line.c_str());
+            exit(1);
+        }
+
+        batch_record record = {};
+        read_target_bytes(target.c_str(), record.target_hash);
+        for (size_t i = 0; i < size; i++) {
+            record.block[i] = (hexchar2int(header[2 * i]) << 4) | hexchar2int(header[2 * i + 1]);
+        }
+        record.block_size = size;
+        records.push_back(record);
+    }
+    return records;
+}
+
+// Hashes expected until a solution, 2^256 / (target + 1).
+double expected_hashes(const uint8_t* target_hash) {
+    double target = 0;
+    for (int i = 3; i >= 0; i--) {
+        target = std::ldexp(target, 64) + ((const uint64_t*) target_hash)[i];
+    }
+    return std::ldexp(1.0, 256) / (target + 1);
+}
+
+// Launches cover about the hashes a header is expected to need, so that most
+// headers take a single launch and none keeps hashing long past its solution.
+size_t batch_global_size(const uint8_t* target_hash, size_t workset_size, size_t local_size, size_t max_global_size) {
+    double groups = std::ceil(expected_hashes(target_hash) / workset_size / local_size);
+    size_t max_groups = std::max<size_t>(1, max_global_size / local_size);
+    return (groups < max_groups ? std::max<size_t>(1, (size_t) groups) : max_groups) * local_size;
+}
+
+// Where the time before the first launch went; see $BIGOLCHUNGUS_DEVICE_CACHE
+// for the discovery part.
+void print_startup(const opencl_backend& backend, bool quiet) {
+    if (quiet) return;
+    fprintf(stderr, "Startup: discovery %.1f ms, context %.1f ms, build %.1f ms\n",
+        backend.discovery_ms, backend.context_ms, backend.build_ms);
+}
+
+// Batch mode: solves every header of a file, each device its own headers.
+int solve_batch(const miner_options& options) {
+    bool quiet = options.quiet;
+    std::vector<batch_record> records = read_batch(options.batch_path);
+
+    opencl_backend backend(0, quiet, options.device_overrides, options.platform_override, options.kernel_path);
+    size_t global_size = options.global_size;
+    size_t local_size = options.local_work_size;
+    size_t workset_size = options.work_set_size;
+    std::string variant = options.kernel_variant != nullptr ? options.kernel_variant : "unrolled";
+    apply_tuning(backend.devices[0].build_key, quiet, variant, local_size, workset_size, global_size);
+    if (!backend.set_kernel_variant(variant)) {
+      fprintf(stderr, "Unknown kernel variant %s\n", variant.c_str());
+      exit(1);
+    }
+    backend.prepare_search(global_size, local_size, workset_size);
+    backend.set_pipeline_depth(1);
+    print_startup(backend, quiet);
+
+    FILE* urandom = fopen("/dev/urandom","rb");
+    for (batch_record& record : records) {
+        record.start_nonce = options.nonce_override;
+        if (!options.nonce_overridden) fread(&record.start_nonce, 1, 8, urandom);
+        record.global_size = batch_global_size(record.target_hash, workset_size, local_size, global_size);
+    }
+    fclose(urandom);
+
+    auto t_start = std::chrono::high_resolution_clock::now();
+    std::atomic<size_t> next_record(0);
+    auto solve = [&](size_t device) {
+        size_t k = next_record++;
+        if (k >= records.size()) return;
+        uint64_t nonce = records[k].start_nonce;
+        backend.queue_search_job(device, records[k].block, records[k].target_hash);
+        backend.enqueue_search(nonce, device, 0, records[k].global_size);
+
+        while (true) {
+            uint64_t candidate = backend.wait_search(device, 0);
+            batch_record& record = records[k];
+            uint64_t launch_nonces = record.global_size * workset_size;
+            record.hashes += launch_nonces;
+            if (stray_solution(record.block, record.block_size, record.target_hash, candidate, nonce, launch_nonces)) {
+                candidate = 0;
+            }
+            nonce += launch_nonces;
+            if (candidate == 0) {
+                backend.enqueue_search(nonce, device, 0, record.global_size);
+                continue;
+            }
+
+            // Keep the device busy with the next header while this solution is checked.
+            size_t next = next_record++;
+            if (next < records.size()) {
+                nonce = records[next].start_nonce;
+                backend.queue_search_job(device, records[next].block, records[next].target_hash);
+                backend.enqueue_search(nonce, device, 0, records[next].global_size);
+            }
+            if (!verify_nonce(record.block, record.block_size, record.target_hash, candidate)) {
+                fprintf(stderr, "Bad nonce!!!\n");
+                exit(-1);
+            }
+            record.nonce = candidate;
+            if (next >= records.size()) return;
+            k = next;
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (size_t device = 1; device < backend.devices.size(); device++) {
+        workers.push_back(std::thread(solve, device));
+    }
+    solve(0);
+    for (std::thread& worker : workers) worker.join();
+    auto t_end = std::chrono::high_resolution_clock::now();
+
+    uint64_t hashes = 0;
+    for (const batch_record& record : records) {
+        printf("%016" PRIx64 " %" PRIu64 "\n", record.nonce, record.hashes);
+        hashes += record.hashes;
+    }
+    double seconds = std::chrono::duration<double>(t_end - t_start).count();
+    fprintf(stderr, "Solved %zu header(s) in %.3f s: %.1f headers/s, %.2f MH/s\n",
+        records.size(), seconds, records.size() / seconds, hashes / seconds / 1e6);
+    return 0;
+}
+
 int main(int argc, char* const* argv) {
     // test_opencl <hash>
     
@@ -101,55 +257,23 @@ int main(int argc, char* const* argv) {
     
     auto t_start = std::chrono::high_resolution_clock::now();
 
-    bool quiet = true;
-    int deviceOverride = 0;
-    int platformOverride = -1;
-    int localWorkSize = 256;
-    int workSetSize = 64;
-    int globalSize = 1024 * 1024 * 16;
-    uint64_t nonceOverride;
-    bool nonceOverridden = false;
-    char* kernelPath = nullptr;
-
-    int opt;
-    while ((opt = getopt(argc, argv, "d:p:l:w:g:k:n:vh")) != -1) {
-      switch(opt) {
-        case 'd':
-          deviceOverride = std::stoi(optarg);
-          break;
-        case 'p':
-          platformOverride = std::stoi(optarg);
-          break;
-        case 'l':
-          localWorkSize = std::stoi(optarg);
-          break;
-        case 'w':
-          workSetSize = std::stoi(optarg);
-          break;
-        case 'g':
-          globalSize = std::stoi(optarg);
-          break;
-        case 'k':
-          kernelPath = optarg;
-          break;
-        case 'v':
-          quiet = false;
-          break;
-        case 'n':
-          nonceOverridden = true;
-          nonceOverride = std::stoi(optarg, 0, 16);
-          break;
-        case 'h':
-        case '?':
-          usage();
-          exit(1);
-          break;
-      }
+    miner_options options = parse_options(argc, argv);
+    bool quiet = options.quiet;
+
+    if (options.hash_mode) {
+      return hash_stdin(options);
+    }
+    if (options.batch_path != nullptr) {
+      return solve_batch(options);
     }
 
+    if (options.target == nullptr) {
+      usage();
+      exit(1);
+    }
 
     uint8_t target_hash[32];
-    read_target_bytes(argv[optind], target_hash);
+    read_target_bytes(options.target, target_hash);
 
     if (!quiet) fprintf(stderr, "Started\n");
 
@@ -161,40 +285,17 @@ int main(int argc, char* const* argv) {
         fprintf(stderr, "\n");
     }
 
-    if (!quiet) fprintf(stderr, "Reading buf\n");
-    const size_t BUF_SIZE = 4 * 1024;
-    uint8_t buf[BUF_SIZE];
-    size_t bufsize = fread(buf, 1, BUF_SIZE, stdin);
-    assert(bufsize >= 8);
-    assert(bufsize < BUF_SIZE);
-
-    if (!quiet) {
-        fprintf(stderr, "hash = ");
-        for (int i = 0; i < bufsize; i++) {
-            fprintf(stderr, "%#x,", buf[i]);
-        }
-        fprintf(stderr, "\n");
-    }
-
-    if (!quiet) fprintf(stderr, "bufsize = %d\n", bufsize);
-
-    assert(320 - 64 + 1 <= bufsize && bufsize <= 320);
-    uint32_t last_block_size = bufsize - (320-64);
-    memset(buf + 256 + last_block_size, 0, 64 - last_block_size);
-
-    if (!quiet) fprintf(stderr, "last_block_size = %d\n", last_block_size);
-
-    size_t global_size = globalSize;
-    size_t local_size = localWorkSize;
-    size_t workset_size = workSetSize;
+    size_t global_size = options.global_size;
+    size_t local_size = options.local_work_size;
+    size_t workset_size = options.work_set_size;
 
     uint64_t nonce_step_size = global_size * workset_size;
     // uint8_t* result = new uint8_t[nonce_step_size * 64];
 
     uint64_t start_nonce = 0;
-    if (nonceOverridden) {
-      start_nonce = nonceOverride;
-      if (!quiet) fprintf(stderr, "Using '0x%X' as nonce.\n", start_nonce);
+    if (options.nonce_overridden) {
+      start_nonce = options.nonce_override;
+      if (!quiet) fprintf(stderr, "Using '0x%lX' as nonce.\n", start_nonce);
     } else {
       if (!quiet) fprintf(stderr, "Using /dev/urandom as nonce source\n");
       FILE* urandom = fopen("/dev/urandom","rb");
@@ -202,45 +303,57 @@ int main(int argc, char* const* argv) {
       fclose(urandom);
     }
 
-    opencl_backend backend(nonce_step_size, quiet, deviceOverride, platformOverride, kernelPath);
-
-    backend.start_search(
-        global_size, local_size, workset_size,
-        buf, target_hash);
-
-    int steps = 0;
-    while (true) {
-        if (!quiet) fprintf(stderr,
-            "Trying %#lx - %#lx\n", start_nonce, start_nonce + nonce_step_size - 1);
-        steps += 1;
-        uint64_t found = backend.continue_search(start_nonce);
+    // Before reading stdin: a stale device cache restarts the process.
+    opencl_backend backend(nonce_step_size, quiet, options.device_overrides, options.platform_override, options.kernel_path);
 
-        if (found != 0) {
-            if (!quiet) fprintf(stderr, "Done %#lx!\n", found);
+    uint8_t buf[320];
+    size_t bufsize = read_block(stdin, buf, quiet);
 
-            blake2s_state state;
-            uint8_t hash[32];
-            blake2s_init(&state, BLAKE2S_OUTBYTES);
-            blake2s_update(&state, &found, 8);
-            blake2s_update(&state, buf + 8, bufsize - 8);
-            blake2s_final(&state, hash, BLAKE2S_OUTBYTES);
+    nonce_coordinator* coordinator = nullptr;
+    if (options.shared_nonces) {
+      coordinator = new nonce_coordinator(target_hash, buf, bufsize, start_nonce, quiet);
+    }
 
-            if (compare_uint256(target_hash, hash) == -1) {
-                fprintf(stderr, "Bad nonce!!!\n");
-                exit(-1);
-            }
+    std::string variant = options.kernel_variant != nullptr ? options.kernel_variant : "unrolled";
+    apply_tuning(backend.devices[0].build_key, quiet, variant, local_size, workset_size, global_size);
+    if (!backend.set_kernel_variant(variant)) {
+      fprintf(stderr, "Unknown kernel variant %s\n", variant.c_str());
+      exit(1);
+    }
 
-            auto t_end = std::chrono::high_resolution_clock::now();
-            float milliseconds = std::chrono::duration<double, std::milli>(t_end-t_start).count();
-            uint64_t numHashes = steps * nonce_step_size;
-            double rate = numHashes / (milliseconds / 1000.0);
-            printf("%016" PRIx64 " %ld %ld", found, numHashes, (uint64_t) rate);
-            break;
-        } else {
-            start_nonce += nonce_step_size;
-        }
+    backend.start_search(
+        global_size, local_size, workset_size,
+        buf, target_hash);
+    print_startup(backend, quiet);
+
+    load_balancer balancer(backend.devices.size(), global_size, local_size, quiet);
+    balancer.set_wave_sizes(backend.wave_sizes());
+    balancer.set_cotenant(options.max_launch_ms, options.duty_cycle);
+
+    search_job job;
+    job.block_data = buf;
+    job.block_size = bufsize;
+    job.target_hash = target_hash;
+    job.start_nonce = start_nonce;
+    job.workset_size = workset_size;
+    job.coordinator = coordinator;
+    job.quiet = quiet;
+    job.hash_share = 0;
+    job.tolerate_bad_nonces = false;
+
+    search_result result = run_search(backend, balancer, job);
+    delete coordinator;
+
+    if (!quiet && balancer.throttle_events() > 0) {
+        fprintf(stderr, "%lu throttle event(s) during this search\n", balancer.throttle_events());
     }
+    if (balancer.cotenant()) balancer.print_cotenant_report();
+
+    auto t_end = std::chrono::high_resolution_clock::now();
+    float milliseconds = std::chrono::duration<double, std::milli>(t_end-t_start).count();
+    uint64_t numHashes = result.hashes;
+    double rate = numHashes / (milliseconds / 1000.0);
+    printf("%016" PRIx64 " %ld %ld", result.nonce, numHashes, (uint64_t) rate);
 
     return 0;
 }
-
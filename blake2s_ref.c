@@ -170,28 +170,24 @@ int blake2s_init_key( blake2s_state *S, size_t outlen, const void *key, size_t k
     G(r,7,v[ 3],v[ 4],v[ 9],v[14]); \
   } while(0)
 
-static void blake2s_compress( blake2s_state *S, const uint8_t in[BLAKE2S_BLOCKBYTES] )
+static void blake2s_compress_words( uint32_t h[8], const uint32_t m[16],
+                                    const uint32_t t[2], const uint32_t f[2] )
 {
-  uint32_t m[16];
   uint32_t v[16];
   size_t i;
 
-  for( i = 0; i < 16; ++i ) {
-    m[i] = load32( in + i * sizeof( m[i] ) );
-  }
-
   for( i = 0; i < 8; ++i ) {
-    v[i] = S->h[i];
+    v[i] = h[i];
   }
 
   v[ 8] = blake2s_IV[0];
   v[ 9] = blake2s_IV[1];
   v[10] = blake2s_IV[2];
   v[11] = blake2s_IV[3];
-  v[12] = S->t[0] ^ blake2s_IV[4];
-  v[13] = S->t[1] ^ blake2s_IV[5];
-  v[14] = S->f[0] ^ blake2s_IV[6];
-  v[15] = S->f[1] ^ blake2s_IV[7];
+  v[12] = t[0] ^ blake2s_IV[4];
+  v[13] = t[1] ^ blake2s_IV[5];
+  v[14] = f[0] ^ blake2s_IV[6];
+  v[15] = f[1] ^ blake2s_IV[7];
 
   ROUND( 0 );
   ROUND( 1 );
@@ -205,13 +201,115 @@ static void blake2s_compress( blake2s_state *S, const uint8_t in[BLAKE2S_BLOCKBY
   ROUND( 9 );
 
   for( i = 0; i < 8; ++i ) {
-    S->h[i] = S->h[i] ^ v[i] ^ v[i + 8];
+    h[i] = h[i] ^ v[i] ^ v[i + 8];
   }
 }
 
 #undef G
 #undef ROUND
 
+static void blake2s_compress( blake2s_state *S, const uint8_t in[BLAKE2S_BLOCKBYTES] )
+{
+  uint32_t m[16];
+  size_t i;
+
+  for( i = 0; i < 16; ++i ) {
+    m[i] = load32( in + i * sizeof( m[i] ) );
+  }
+
+  blake2s_compress_words( S->h, m, S->t, S->f );
+}
+
+/* IV XOR the parameter block of blake2s_init( S, BLAKE2S_OUTBYTES ):
+   digest length 32, fanout 1, depth 1, everything else 0. */
+const blake2s_fixed_state blake2s_fixed_initial =
+{
+  {
+    0x6A09E667UL ^ 0x01010020UL, 0xBB67AE85UL, 0x3C6EF372UL, 0xA54FF53AUL,
+    0x510E527FUL, 0x9B05688CUL, 0x1F83D9ABUL, 0x5BE0CD19UL
+  },
+  { 0, 0 }
+};
+
+static const uint32_t blake2s_fixed_more[2] = { 0, 0 };
+static const uint32_t blake2s_fixed_last[2] = { (uint32_t)-1, 0 };
+
+static void blake2s_fixed_increment( uint32_t t[2], uint32_t inc )
+{
+  t[0] += inc;
+  t[1] += ( t[0] < inc );
+}
+
+void blake2s_fixed_blocks( blake2s_fixed_state *S, const void *pin, size_t inlen )
+{
+  const uint8_t *in = ( const uint8_t * )pin;
+  uint32_t m[16];
+  size_t i;
+
+  for( ; inlen >= BLAKE2S_BLOCKBYTES; inlen -= BLAKE2S_BLOCKBYTES, in += BLAKE2S_BLOCKBYTES ) {
+    for( i = 0; i < 16; ++i ) {
+      m[i] = load32( in + i * sizeof( m[i] ) );
+    }
+    blake2s_fixed_increment( S->t, BLAKE2S_BLOCKBYTES );
+    blake2s_compress_words( S->h, m, S->t, blake2s_fixed_more );
+  }
+}
+
+void blake2s_fixed_head_block( blake2s_fixed_state *S, const void *head, const void *rest )
+{
+  const uint8_t *in = ( const uint8_t * )rest;
+  uint32_t m[16];
+  size_t i;
+
+  m[0] = load32( head );
+  m[1] = load32( ( const uint8_t * )head + 4 );
+  for( i = 2; i < 16; ++i ) {
+    m[i] = load32( in + ( i - 2 ) * sizeof( m[i] ) );
+  }
+  blake2s_fixed_increment( S->t, BLAKE2S_BLOCKBYTES );
+  blake2s_compress_words( S->h, m, S->t, blake2s_fixed_more );
+}
+
+void blake2s_fixed_final( const blake2s_fixed_state *S, const void *pin, size_t inlen, void *out )
+{
+  const uint8_t *in = ( const uint8_t * )pin;
+  uint32_t h[8];
+  uint32_t t[2];
+  uint32_t m[16];
+  size_t i, j;
+
+  /* Whole words in place, then the bytes of a partial one; the padding
+     is just the words left at 0. */
+  for( i = 0; i < inlen / 4; ++i ) {
+    m[i] = load32( in + i * sizeof( m[i] ) );
+  }
+  if( inlen % 4 != 0 ) {
+    m[i] = 0;
+    for( j = 0; j < inlen % 4; ++j ) m[i] |= ( uint32_t )in[4 * i + j] << ( 8 * j );
+    ++i;
+  }
+  for( ; i < 16; ++i ) m[i] = 0;
+
+  for( i = 0; i < 8; ++i ) h[i] = S->h[i];
+  t[0] = S->t[0];
+  t[1] = S->t[1];
+  blake2s_fixed_increment( t, ( uint32_t )inlen );
+  blake2s_compress_words( h, m, t, blake2s_fixed_last );
+
+  for( i = 0; i < 8; ++i )
+    store32( ( uint8_t * )out + sizeof( h[i] ) * i, h[i] );
+}
+
+void blake2s_fixed( void *out, const void *pin, size_t inlen )
+{
+  const uint8_t *in = ( const uint8_t * )pin;
+  blake2s_fixed_state S = blake2s_fixed_initial;
+  size_t tail = inlen == 0 ? 0 : ( inlen - 1 ) % BLAKE2S_BLOCKBYTES + 1;
+
+  blake2s_fixed_blocks( &S, in, inlen - tail );
+  blake2s_fixed_final( &S, in + inlen - tail, tail, out );
+}
+
 int blake2s_update( blake2s_state *S, const void *pin, size_t inlen )
 {
   const unsigned char * in = (const unsigned char *)pin;
@@ -78,6 +78,35 @@ extern "C" {
   /* Simple API */
   int blake2s( void *out, size_t outlen, const void *in, size_t inlen, const void *key, size_t keylen );
 
+  /* Fixed-block API: unkeyed, BLAKE2S_OUTBYTES digests only. Whole blocks are
+     compressed straight from the caller's memory, and the last block is read
+     in place without copying or padding it. A state is small enough to copy,
+     e.g. from blake2s_fixed_initial for every nonce of one header. */
+  typedef struct blake2s_fixed_state__
+  {
+    uint32_t h[8];
+    uint32_t t[2];
+  } blake2s_fixed_state;
+
+  /* The state before the first byte of a message. */
+  extern const blake2s_fixed_state blake2s_fixed_initial;
+
+  /* Compresses the inlen / BLAKE2S_BLOCKBYTES whole blocks at in. Never
+     give it the last block of the message, even a whole one. */
+  void blake2s_fixed_blocks( blake2s_fixed_state *S, const void *in, size_t inlen );
+
+  /* Compresses the block made of the 8 bytes at head and the 56 at rest,
+     such as a nonce and the header that follows it. Not the last block. */
+  void blake2s_fixed_head_block( blake2s_fixed_state *S, const void *head, const void *rest );
+
+  /* Writes the digest of the message ending in the inlen bytes at in, 1 to
+     BLAKE2S_BLOCKBYTES of them (0 only for the empty message). S is left
+     as it was, so it can finish other messages with the same prefix. */
+  void blake2s_fixed_final( const blake2s_fixed_state *S, const void *in, size_t inlen, void *out );
+
+  /* blake2s( out, BLAKE2S_OUTBYTES, in, inlen, NULL, 0 ) through the above. */
+  void blake2s_fixed( void *out, const void *in, size_t inlen );
+
 #if defined(__cplusplus)
 }
 #endif
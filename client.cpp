@@ -0,0 +1,148 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <cstdlib>
+#include <inttypes.h>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "common.h"
+#include "daemon_socket.hpp"
+#include "options.hpp"
+
+// chungus-client: the bigolchungus command line in front of chungusd.
+//
+// chainweb-miner execs its --miner-path for every work item. Pointing it at
+// this binary instead of bigolchungus turns each exec into one socket round
+// trip to a daemon whose contexts and kernels are already warm.
+
+int connect_or_exit() {
+    std::string path = daemon_socket_path();
+    int fd = connect_daemon(path);
+    if (fd < 0) {
+        fprintf(stderr, "Cannot connect to chungusd at %s: %s\n", path.c_str(), strerror(errno));
+        exit(1);
+    }
+    return fd;
+}
+
+std::string read_reply(int fd, const char* expected) {
+    std::string reply;
+    if (!read_line(fd, reply)) {
+        fprintf(stderr, "chungusd closed the connection\n");
+        exit(1);
+    }
+    if (reply.compare(0, strlen(expected), expected) != 0) {
+        fprintf(stderr, "chungusd: %s\n", reply.c_str());
+        exit(1);
+    }
+    return reply.substr(strlen(expected));
+}
+
+int hash_stdin() {
+    std::vector<uint8_t> data;
+    std::vector<uint32_t> offsets;
+    read_hex_messages(std::cin, data, offsets);
+    size_t count = offsets.size() - 1;
+
+    int fd = connect_or_exit();
+    write_line(fd, "hash " + std::to_string(count) + " " + std::to_string(data.size()));
+    write_all(fd, offsets.data(), offsets.size() * sizeof(uint32_t));
+    write_all(fd, data.data(), data.size());
+
+    read_reply(fd, "digests ");
+    std::vector<uint8_t> digests(32 * count);
+    if (!read_exact(fd, digests.data(), digests.size())) {
+        fprintf(stderr, "chungusd closed the connection\n");
+        exit(1);
+    }
+    for (size_t k = 0; k < count; k++) {
+        for (int i = 0; i < 32; i++) printf("%02x", digests[32 * k + i]);
+        printf("\n");
+    }
+    return 0;
+}
+
+// Changes the co-tenant settings of the running daemon.
+int set_cotenant(const miner_options& options) {
+    std::ostringstream request;
+    request << "cotenant " << options.max_launch_ms << " " << options.duty_cycle * 100;
+    int fd = connect_or_exit();
+    write_line(fd, request.str());
+    read_reply(fd, "ok");
+    return 0;
+}
+
+int main(int argc, char* const* argv) {
+    if (argc == 1) {
+      usage();
+      exit(1);
+    }
+
+    miner_options options = parse_options(argc, argv);
+    if (options.hash_mode) {
+      return hash_stdin();
+    }
+    if (options.batch_path != nullptr) {
+      fprintf(stderr, "Batch mode (-B) needs bigolchungus itself\n");
+      exit(1);
+    }
+    if (options.cotenant) {
+      set_cotenant(options);
+      if (options.target == nullptr) return 0;
+    }
+    if (options.target == nullptr || strlen(options.target) != 64) {
+      usage();
+      exit(1);
+    }
+
+    uint8_t buf[320];
+    size_t bufsize = read_block(stdin, buf, options.quiet);
+
+    // The daemon has its own working directory.
+    std::string kernel = "-";
+    if (options.kernel_path != nullptr) {
+        char* resolved = realpath(options.kernel_path, nullptr);
+        kernel = resolved != nullptr ? resolved : options.kernel_path;
+        free(resolved);
+    }
+    // Fields of the search line are separated by whitespace.
+    if (kernel.find_first_of(" \t\n") != std::string::npos) {
+        fprintf(stderr, "chungusd cannot take a kernel path with whitespace: %s\n", kernel.c_str());
+        exit(1);
+    }
+
+    std::string variant = options.kernel_variant != nullptr ? options.kernel_variant : "-";
+
+    std::ostringstream devices;
+    for (size_t i = 0; i < options.device_overrides.size(); i++) {
+        devices << (i == 0 ? "" : ",") << options.device_overrides[i];
+    }
+
+    char nonce[17] = "-";
+    if (options.nonce_overridden) snprintf(nonce, sizeof(nonce), "%" PRIx64, options.nonce_override);
+
+    std::ostringstream request;
+    request << "search " << options.platform_override << " " << devices.str()
+            << " " << options.local_work_size << " " << options.work_set_size
+            << " " << options.global_size << " " << kernel << " " << variant << " " << nonce
+            << " " << (options.shared_nonces ? 1 : 0) << " " << (options.quiet ? 0 : 1)
+            << " " << options.target << " " << bufsize;
+
+    int fd = connect_or_exit();
+    write_line(fd, request.str());
+    write_all(fd, buf, bufsize);
+
+    std::istringstream reply(read_reply(fd, "found "));
+    std::string found;
+    uint64_t hashes, rate;
+    reply >> found >> hashes >> rate;
+    uint64_t nonce_found = std::stoull(found, 0, 16);
+    printf("%016" PRIx64 " %" PRIu64 " %" PRIu64, nonce_found, hashes, rate);
+
+    return 0;
+}
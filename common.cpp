@@ -1,6 +1,11 @@
+#include "blake2s_ref.h"
 #include "common.h"
 
 #include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <sstream>
 
 uint8_t hexchar2int(char c) {
     if ('0' <= c && c <= '9') c -= '0';
@@ -20,4 +25,52 @@ int compare_uint256(const void* first, const void* second) {
         else return -1;
     }
     return 0;
-}
\ No newline at end of file
+}
+
+bool verify_nonce(const uint8_t* block_data, size_t block_size, const uint8_t* target_hash, uint64_t nonce) {
+    // Straight from block_data, with the nonce in place of its first 8 bytes.
+    // Headers are several blocks long, so the nonce is never in the last one.
+    assert(block_size > BLAKE2S_BLOCKBYTES);
+    blake2s_fixed_state state = blake2s_fixed_initial;
+    uint8_t hash[32];
+    size_t tail = (block_size - 1) % BLAKE2S_BLOCKBYTES + 1;
+    blake2s_fixed_head_block(&state, &nonce, block_data + 8);
+    blake2s_fixed_blocks(&state, block_data + BLAKE2S_BLOCKBYTES, block_size - BLAKE2S_BLOCKBYTES - tail);
+    blake2s_fixed_final(&state, block_data + block_size - tail, tail, hash);
+
+    return compare_uint256(target_hash, hash) != -1;
+}
+
+bool stray_solution(
+    const uint8_t* block_data, size_t block_size, const uint8_t* target_hash,
+    uint64_t candidate, uint64_t nonce, uint64_t count
+) {
+    return candidate != 0 && candidate - nonce >= count
+        && verify_nonce(block_data, block_size, target_hash, candidate);
+}
+
+// Parses a comma separated list such as "0,1,2".
+std::vector<int> parse_int_list(const char* str) {
+    std::vector<int> result;
+    std::stringstream ss(str);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        result.push_back(std::stoi(item));
+    }
+    return result;
+}
+
+void read_hex_messages(std::istream& in, std::vector<uint8_t>& data, std::vector<uint32_t>& offsets) {
+    offsets.assign(1, 0);
+    std::string line;
+    for (size_t n = 1; std::getline(in, line); n++) {
+        if (line.size() % 2 != 0 || line.find_first_not_of("0123456789abcdef") != std::string::npos) {
+            fprintf(stderr, "Line %zu is not a message of lowercase hexadecimal byte pairs\n", n);
+            exit(1);
+        }
+        for (size_t i = 0; i < line.size(); i += 2) {
+            data.push_back((hexchar2int(line[i]) << 4) | hexchar2int(line[i + 1]));
+        }
+        offsets.push_back(data.size());
+    }
+}
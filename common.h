@@ -1,6 +1,27 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
+#include <istream>
+#include <vector>
 
 uint8_t hexchar2int(char c);
-int compare_uint256(const void* first, const void* second);
\ No newline at end of file
+int compare_uint256(const void* first, const void* second);
+
+// Checks on the host that `nonce` meets the target for the header.
+bool verify_nonce(const uint8_t* block_data, size_t block_size, const uint8_t* target_hash, uint64_t nonce);
+
+// Whether `candidate`, returned by a launch of the `count` nonces from `nonce`,
+// is a solution outside them. A launch split at 2^32 also searches a few
+// nonces before and after its range, which belong to other launches, other
+// processes' claims or lie before the start; such hits are dropped. A hit that
+// fails verification is not stray, so that it is still reported as bad.
+bool stray_solution(
+    const uint8_t* block_data, size_t block_size, const uint8_t* target_hash,
+    uint64_t candidate, uint64_t nonce, uint64_t count);
+
+std::vector<int> parse_int_list(const char* str);
+
+// Reads one hexadecimal message per line, as the -H modes take them: message
+// k goes to data[offsets[k] .. offsets[k + 1]). Exits on a malformed line.
+void read_hex_messages(std::istream& in, std::vector<uint8_t>& data, std::vector<uint32_t>& offsets);
\ No newline at end of file
@@ -0,0 +1,180 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cassert>
+#include <cstdint>
+#include <inttypes.h>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "cpu_backend.hpp"
+#include "nonce_coordinator.hpp"
+#include "options.hpp"
+
+// chungus-cpu: bigolchungus on host threads, for machines without an OpenCL
+// runtime and for checking the GPUs against the same kernel source.
+//
+// It takes the bigolchungus command line; the device, platform, kernel and
+// work size options are accepted and ignored, except that -g still caps the
+// work items per launch. $BIGOLCHUNGUS_CPU_THREADS sets the number of threads
+// (default: all of them).
+//
+// Unlike the GPUs it reports the first solution at or after the start nonce,
+// whatever the thread count and launch size, which test/make-corpus.py relies
+// on for its distances to the first solution.
+
+// Work items per thread and launch: long enough to amortize starting the
+// threads, short enough to notice a solution from another process soon.
+const size_t CPU_ITEMS_PER_THREAD = 4096;
+
+size_t cpu_threads() {
+    const char* threads = getenv("BIGOLCHUNGUS_CPU_THREADS");
+    return threads != nullptr ? std::stoul(threads) : 0;
+}
+
+// The first nonce in the `items` work items from `nonce` that meets the
+// target, or 0. Halves the range until the hit is within one work item, then
+// checks its nonces in order on the host; this costs about one more launch.
+// A launch split at 2^32 also covers some nonces before and after its range,
+// so only the host check decides what is in the range.
+uint64_t first_solution(
+    cpu_backend& backend, const uint8_t* buf, size_t bufsize, const uint8_t* target_hash,
+    uint64_t nonce, size_t items
+) {
+    if (items == 1) {
+        for (uint64_t i = 0; i < CPU_WORKSET_SIZE; i++) {
+            if (verify_nonce(buf, bufsize, target_hash, nonce + i)) return nonce + i;
+        }
+        return 0;
+    }
+
+    size_t half = items / 2;
+    if (backend.continue_search(nonce, half) != 0) {
+        uint64_t first = first_solution(backend, buf, bufsize, target_hash, nonce, half);
+        if (first != 0) return first;
+    }
+    uint64_t rest = nonce + half * CPU_WORKSET_SIZE;
+    if (backend.continue_search(rest, items - half) != 0) {
+        return first_solution(backend, buf, bufsize, target_hash, rest, items - half);
+    }
+    return 0;
+}
+
+int hash_stdin(const miner_options& options) {
+    std::vector<uint8_t> data;
+    std::vector<uint32_t> offsets;
+    read_hex_messages(std::cin, data, offsets);
+    size_t count = offsets.size() - 1;
+    std::vector<uint8_t> digests(32 * count);
+
+    cpu_backend backend(cpu_threads());
+    auto t_start = std::chrono::high_resolution_clock::now();
+    backend.hash_messages(data.data(), offsets.data(), count, digests.data());
+    auto t_end = std::chrono::high_resolution_clock::now();
+    if (!options.quiet) fprintf(stderr, "Hashed %zu messages in %.3f ms\n",
+        count, std::chrono::duration<double, std::milli>(t_end - t_start).count());
+
+    for (size_t k = 0; k < count; k++) {
+        for (int i = 0; i < 32; i++) printf("%02x", digests[32 * k + i]);
+        printf("\n");
+    }
+    return 0;
+}
+
+int main(int argc, char* const* argv) {
+    if (argc == 1) {
+      usage();
+      exit(1);
+    }
+
+    auto t_start = std::chrono::high_resolution_clock::now();
+
+    miner_options options = parse_options(argc, argv);
+    bool quiet = options.quiet;
+
+    if (options.hash_mode) {
+      return hash_stdin(options);
+    }
+    if (options.batch_path != nullptr) {
+      fprintf(stderr, "Batch mode (-B) needs bigolchungus\n");
+      exit(1);
+    }
+
+    if (options.target == nullptr) {
+      usage();
+      exit(1);
+    }
+
+    uint8_t target_hash[32];
+    read_target_bytes(options.target, target_hash);
+
+    uint8_t buf[320];
+    size_t bufsize = read_block(stdin, buf, quiet);
+
+    uint64_t start_nonce = 0;
+    if (options.nonce_overridden) {
+      start_nonce = options.nonce_override;
+    } else {
+      FILE* urandom = fopen("/dev/urandom","rb");
+      fread(&start_nonce, 1, 8, urandom);
+      fclose(urandom);
+    }
+
+    nonce_coordinator* coordinator = nullptr;
+    if (options.shared_nonces) {
+      coordinator = new nonce_coordinator(target_hash, buf, bufsize, start_nonce, quiet);
+    }
+
+    cpu_backend backend(cpu_threads());
+    backend.set_search_job(buf, target_hash);
+
+    size_t items = std::min<size_t>(options.global_size, backend.threads * CPU_ITEMS_PER_THREAD);
+    uint64_t launch_nonces = items * CPU_WORKSET_SIZE;
+    if (!quiet) fprintf(stderr, "Searching on %zu thread(s), %zu work items per launch\n", backend.threads, items);
+
+    uint64_t next_nonce = start_nonce;
+    uint64_t hashes = 0;
+    uint64_t nonce = 0;
+    while (nonce == 0) {
+        uint64_t candidate = 0;
+        if (coordinator != nullptr && coordinator->solved(&candidate)) {
+            if (!quiet) fprintf(stderr, "Solved by another process: %#lx\n", candidate);
+        } else {
+            uint64_t first = coordinator != nullptr ? coordinator->claim(launch_nonces) : next_nonce;
+            next_nonce = first + launch_nonces;
+            candidate = backend.continue_search(first, items);
+            if (candidate != 0) {
+                // Keep the kernel's hit if the host finds none, so that it fails verification below.
+                uint64_t exact = first_solution(backend, buf, bufsize, target_hash, first, items);
+                if (exact != 0) {
+                    candidate = exact;
+                } else if (stray_solution(buf, bufsize, target_hash, candidate, first, launch_nonces)) {
+                    candidate = 0;
+                }
+            }
+            hashes += launch_nonces;
+            if (coordinator != nullptr) coordinator->complete(first, launch_nonces);
+        }
+
+        if (candidate == 0) continue;
+        if (!verify_nonce(buf, bufsize, target_hash, candidate)) {
+            fprintf(stderr, "Bad nonce!!!\n");
+            exit(-1);
+        }
+        nonce = candidate;
+    }
+
+    if (coordinator != nullptr) {
+        coordinator->publish(nonce);
+        delete coordinator;
+    }
+
+    auto t_end = std::chrono::high_resolution_clock::now();
+    double seconds = std::chrono::duration<double>(t_end - t_start).count();
+    printf("%016" PRIx64 " %ld %ld", nonce, hashes, (uint64_t) (hashes / seconds));
+
+    return 0;
+}
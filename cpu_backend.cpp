@@ -0,0 +1,139 @@
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "cpu_backend.hpp"
+#include "perf_stats.hpp"
+
+// Threads 1 .. threads - 1 of a backend; the launching thread is thread 0.
+struct cpu_workers {
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable started, finished;
+    const std::function<void(size_t)>* task;   // guarded by mutex, like the rest
+    uint64_t generation;                       // of the current task
+    size_t running;                            // threads not done with it yet
+    bool stopping;
+
+    explicit cpu_workers(size_t count) : task(nullptr), generation(0), running(0), stopping(false) {
+        for (size_t t = 1; t < count; t++) threads.push_back(std::thread(&cpu_workers::work, this, t));
+    }
+
+    ~cpu_workers() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        started.notify_all();
+        for (std::thread& thread : threads) thread.join();
+    }
+
+    void work(size_t t) {
+        uint64_t seen = 0;
+        while (true) {
+            const std::function<void(size_t)>* current;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                started.wait(lock, [&]() { return stopping || generation != seen; });
+                if (stopping) return;
+                seen = generation;
+                current = task;
+            }
+            (*current)(t);
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--running == 0) finished.notify_one();
+        }
+    }
+
+    // Calls f(t) for every thread t and returns once all calls returned.
+    void run(const std::function<void(size_t)>& f) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            task = &f;
+            running = threads.size();
+            generation += 1;
+        }
+        started.notify_all();
+        f(0);
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [&]() { return running == 0; });
+    }
+};
+
+cpu_backend::cpu_backend(size_t threads) : threads(threads) {
+    if (this->threads == 0) this->threads = std::max(1u, std::thread::hardware_concurrency());
+    memset(header, 0, sizeof(header));
+    memset(target, 0, sizeof(target));
+    workers = new cpu_workers(this->threads);
+}
+
+cpu_backend::~cpu_backend() {
+    delete workers;
+}
+
+void cpu_backend::set_search_job(const uint8_t* block_data, const uint8_t* target_hash) {
+    memcpy(header, block_data, sizeof(header));
+    memcpy(target, target_hash, sizeof(target));
+}
+
+uint64_t cpu_backend::continue_search(uint64_t nonce, size_t items) {
+    auto t_start = std::chrono::high_resolution_clock::now();
+
+    // The kernel counts 32-bit nonces, so like on the GPUs a range that
+    // crosses a multiple of 2^32 is split there into one launch that ends on
+    // the boundary and one that starts on it.
+    const uint64_t W = CPU_WORKSET_SIZE;
+    uint64_t count = items * W;
+    uint64_t below = ((uint64_t) 1 << 32) - (nonce & 0xFFFFFFFF);
+
+    std::vector<std::pair<uint64_t, size_t> > launches;
+    if (count <= below) {
+        launches.push_back(std::make_pair(nonce, items));
+    } else {
+        size_t first = (below + W - 1) / W;
+        size_t second = (count - below + W - 1) / W;
+        launches.push_back(std::make_pair(nonce + below - first * W, first));
+        launches.push_back(std::make_pair(nonce + below, second));
+    }
+
+    std::vector<uint64_t> results(threads, 0);
+    for (const std::pair<uint64_t, size_t>& launch : launches) {
+        workers->run([&](size_t t) {
+            size_t begin = launch.second * t / threads;
+            size_t end = launch.second * (t + 1) / threads;
+            for (size_t gid = begin; gid < end; gid++) {
+                cpu_search_nonce(launch.first, gid, &results[t], header, target);
+            }
+        });
+    }
+
+    auto t_end = std::chrono::high_resolution_clock::now();
+    perf_count(PERF_LAUNCHES);
+    perf_count(PERF_HASHES, count);
+    perf_record(PERF_LAUNCH_NS, std::chrono::duration_cast<std::chrono::nanoseconds>(t_end - t_start).count());
+
+    for (uint64_t result : results) {
+        if (result != 0) return result;
+    }
+    return 0;
+}
+
+void cpu_backend::hash_messages(const uint8_t* data, const uint32_t* offsets, size_t count, uint8_t* digests) {
+    auto t_start = std::chrono::high_resolution_clock::now();
+    workers->run([&](size_t t) {
+        for (size_t gid = count * t / threads; gid < count * (t + 1) / threads; gid++) {
+            cpu_hash_batch(gid, data, offsets, count, (uint32_t*) digests);
+        }
+    });
+
+    auto t_end = std::chrono::high_resolution_clock::now();
+    perf_count(PERF_HASH_BATCHES);
+    perf_count(PERF_HASH_MESSAGES, count);
+    perf_record(PERF_HASH_BATCH_NS, std::chrono::duration_cast<std::chrono::nanoseconds>(t_end - t_start).count());
+}
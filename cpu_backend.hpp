@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Nonces per work item of the CPU kernel. The nonce loop of one work item is
+// what the compiler vectorizes, so this is a multiple of every SIMD width.
+#define CPU_WORKSET_SIZE 64
+
+// kernels/kernel.cl compiled for the host (cpu_kernel.cpp and
+// cpu_hash_kernel.cpp), one work item per call.
+void cpu_search_nonce(
+    uint64_t start_nonce, size_t gid, uint64_t* result,
+    const uint32_t* header, const uint64_t* target);
+void cpu_hash_batch(
+    size_t gid, const uint8_t* data, const uint32_t* offsets, uint32_t count,
+    uint32_t* digests);
+
+// Thread pool of a cpu_backend, see cpu_backend.cpp. Only declared here: the
+// kernel translation units include this header after kernels/cl_compat.h,
+// whose macros the standard thread headers do not survive.
+struct cpu_workers;
+
+// Runs the search and hashing kernels on host threads, without an OpenCL
+// runtime. Work items of a launch are split evenly between the threads, which
+// live as long as the backend, so a launch costs a wake-up rather than
+// starting threads. One thread at a time may launch.
+struct cpu_backend {
+    size_t threads;
+    uint32_t header[80];   // the zero padded 320 byte block
+    uint64_t target[4];
+    cpu_workers* workers;
+
+    // 0 threads uses every hardware thread.
+    explicit cpu_backend(size_t threads);
+    ~cpu_backend();
+    cpu_backend(const cpu_backend&) = delete;
+    cpu_backend& operator=(const cpu_backend&) = delete;
+
+    void set_search_job(const uint8_t* block_data, const uint8_t* target_hash);
+
+    // Searches `items` work items of CPU_WORKSET_SIZE nonces from `nonce`
+    // and returns a nonce that meets the target, or 0.
+    uint64_t continue_search(uint64_t nonce, size_t items);
+
+    // Blake2s-256 of messages data[offsets[k] .. offsets[k + 1]) into
+    // digests[32 * k .. 32 * k + 32).
+    void hash_messages(const uint8_t* data, const uint32_t* offsets, size_t count, uint8_t* digests);
+};
@@ -0,0 +1,16 @@
+// The hashing kernel of kernels/kernel.cl built for the host; see
+// kernels/cl_compat.h.
+
+#include "kernels/cl_compat.h"
+#include "cpu_backend.hpp"
+
+#define BATCH_HASH
+#include "kernels/kernel.cl"
+
+void cpu_hash_batch(
+    size_t gid, const uint8_t* data, const uint32_t* offsets, uint32_t count,
+    uint32_t* digests
+) {
+    cl_compat::global_id = gid;
+    hash_batch(data, offsets, count, digests);
+}
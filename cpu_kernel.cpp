@@ -0,0 +1,21 @@
+// The search kernel of kernels/kernel.cl built for the host; see
+// kernels/cl_compat.h. It always takes the header at run time and counts
+// 32-bit nonces, the form the compiler vectorizes.
+
+#include "kernels/cl_compat.h"
+#include "cpu_backend.hpp"
+
+thread_local size_t cl_compat::global_id;
+
+#define RUNTIME_HEADER
+#define NONCE32
+#define WORKSET_SIZE CPU_WORKSET_SIZE
+#include "kernels/kernel.cl"
+
+void cpu_search_nonce(
+    uint64_t start_nonce, size_t gid, uint64_t* result,
+    const uint32_t* header, const uint64_t* target
+) {
+    cl_compat::global_id = gid;
+    search_nonce(start_nonce, result, header, target[3], target[2], target[1], target[0]);
+}
@@ -0,0 +1,688 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <inttypes.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "daemon_socket.hpp"
+#include "load_balancer.hpp"
+#include "nonce_coordinator.hpp"
+#include "opencl_backend.hpp"
+#include "search.hpp"
+#include "stats_server.hpp"
+#include "tuning_db.hpp"
+
+void usage() {
+  fprintf(
+    stderr,
+    "  chungusd [ -d <device id(s)>      ]\n"
+    "           [ -p <platform id>       ]\n"
+    "           [ -l <local work size>   ]\n"
+    "           [ -w <work set size>     ]\n"
+    "           [ -g <global work size>  ]\n"
+    "           [ -k <kernel location>   ]\n"
+    "           [ -V <kernel variant>    ]\n"
+    "           [ -S <hashing share>     ]\n"
+    "           [ -c <max launch ms>     ]\n"
+    "           [ -u <duty cycle %%>      ]\n"
+    "           [ -M <[host:]port>       ]\n"
+    "           [ -R                     ]\n"
+    "           [ -v                     ]\n\n"
+    "  Resident mining engine. Keeps OpenCL contexts and compiled kernels warm and\n"
+    "  serves jobs forwarded by chungus-client, a drop-in replacement for\n"
+    "  bigolchungus that chainweb-miner can exec for every work item.\n\n"
+    "  The socket is $BIGOLCHUNGUS_SOCKET, or /tmp/bigolchungus-<uid>.sock.\n\n"
+    "  -d, -p, -l, -w, -g, -k and -V are the defaults for jobs that do not set them,\n"
+    "  with the same meaning as for bigolchungus. An engine for the defaults is\n"
+    "  built at startup; engines for other settings are built on first use and\n"
+    "  kept.\n\n"
+    "    -S <hashing share>\n"
+    "      Percentage of device time that queued hashing jobs may take from a\n"
+    "      running search. Default `0`: hash only while no search is running.\n\n"
+    "    -c <max launch ms>, -u <duty cycle %%>\n"
+    "      Co-tenant mode, as for bigolchungus. `chungus-client -c ... -u ...` changes\n"
+    "      both while the daemon runs.\n\n"
+    "    -M <[host:]port>\n"
+    "      Serves the live statistics of every engine's devices at GET /stats, for\n"
+    "      chungus-farm: hashrate, launch duration, bad nonces and throttling next\n"
+    "      to the device's tuning database entry. Bad nonces are counted there\n"
+    "      instead of stopping the daemon.\n\n"
+    "    -R\n"
+    "      Take over from the daemon running on the socket, e.g. after an upgrade.\n"
+    "      It keeps mining while this one builds the same engines; then this one\n"
+    "      takes the socket path, the old one hands over its running searches with\n"
+    "      the nonces they have covered, and exits. Clients do not notice.\n\n"
+  );
+}
+
+struct engine_config {
+    int platform;
+    std::vector<int> devices;
+    size_t local_size;
+    size_t workset_size;
+    size_t global_size;
+    std::string kernel_path;
+    std::string variant;
+
+    std::string key() const {
+        std::ostringstream ss;
+        ss << platform << "|";
+        for (int device : devices) ss << device << ",";
+        ss << "|" << local_size << "|" << workset_size << "|" << global_size << "|" << kernel_path << "|" << variant;
+        return ss.str();
+    }
+
+    // As sent in search and handoff lines.
+    std::string fields() const {
+        std::ostringstream ss;
+        ss << platform << " ";
+        for (size_t i = 0; i < devices.size(); i++) ss << (i > 0 ? "," : "") << devices[i];
+        ss << " " << local_size << " " << workset_size << " " << global_size << " " << kernel_path << " " << variant;
+        return ss.str();
+    }
+
+    // Reads fields(); a kernel or variant of `-` takes the one of `defaults`.
+    bool read(std::istream& in, const engine_config& defaults) {
+        std::string deviceList, kernel, variantName;
+        in >> platform >> deviceList >> local_size >> workset_size >> global_size >> kernel >> variantName;
+        if (!in) return false;
+        devices = parse_int_list(deviceList.c_str());
+        kernel_path = kernel == "-" ? defaults.kernel_path : kernel;
+        variant = variantName == "-" ? defaults.variant : variantName;
+        return true;
+    }
+};
+
+// A warm backend for one combination of platform, devices and work sizes.
+struct engine {
+    opencl_backend* backend;
+    load_balancer* balancer;
+    size_t global_size;
+    size_t local_size;
+    size_t workset_size;
+    std::string kernel_path;   // the backend keeps a pointer into it
+    engine_config config;      // as requested, for a replacement daemon
+    std::mutex mutex;          // one search at a time
+};
+
+// A search as a client sent it. A daemon that is being replaced hands it over
+// with the nonces from start_nonce up to cursor already searched.
+struct search_request {
+    engine_config config;
+    uint8_t block[320];
+    size_t block_size;
+    uint8_t target_hash[32];
+    std::string target;
+    uint64_t start_nonce;
+    uint64_t cursor;
+    uint64_t hashes;
+    double elapsed_ms;
+    int shared;
+    int verbose;
+};
+
+void decode_target(search_request& request) {
+    for (size_t i = 0; i < 32; i++) {
+        request.target_hash[i] = (hexchar2int(request.target[2 * i]) << 4) | hexchar2int(request.target[2 * i + 1]);
+    }
+}
+
+struct daemon_state {
+    engine_config defaults;
+    double hash_share;
+    double max_launch_ms;   // co-tenant settings, guarded by engines_mutex
+    double duty_cycle;
+    bool quiet;
+
+    std::mutex engines_mutex;
+    std::map<std::string, engine*> engines;
+
+    // Open connections, including searches handed over by a replaced daemon.
+    size_t connections;
+    std::mutex connections_mutex;
+    std::condition_variable connections_cv;
+
+    // Set once a replacement daemon (-R) has asked for the running searches;
+    // they are then written to handoff_fd, and this daemon exits once drained.
+    int listener;
+    std::atomic<bool> handing_off;
+    std::mutex handoff_mutex;
+    int handoff_fd;
+    bool accepting;    // guarded by connections_mutex, like handed_off
+    bool handed_off;
+};
+
+// The GET /stats reply, see stats_server.hpp.
+std::string engine_stats(daemon_state& state) {
+    std::lock_guard<std::mutex> lock(state.engines_mutex);
+    std::string report;
+    for (const auto& it : state.engines) {
+        engine* e = it.second;
+        append_device_stats(report, e->config.platform, e->config.devices,
+            *e->backend, *e->balancer, e->workset_size);
+    }
+    return report;
+}
+
+void connection_opened(daemon_state& state) {
+    std::lock_guard<std::mutex> lock(state.connections_mutex);
+    state.connections++;
+}
+
+void connection_closed(daemon_state& state) {
+    std::lock_guard<std::mutex> lock(state.connections_mutex);
+    state.connections--;
+    state.connections_cv.notify_all();
+}
+
+engine* get_engine(daemon_state& state, const engine_config& config) {
+    std::lock_guard<std::mutex> lock(state.engines_mutex);
+    std::map<std::string, engine*>::iterator it = state.engines.find(config.key());
+    if (it != state.engines.end()) return it->second;
+
+    if (!state.quiet) std::cerr << "Building engine " << config.key() << std::endl;
+    auto t_start = std::chrono::high_resolution_clock::now();
+
+    engine* e = new engine();
+    e->config = config;
+    e->global_size = config.global_size;
+    e->local_size = config.local_size;
+    e->workset_size = config.workset_size;
+    e->kernel_path = config.kernel_path;
+    e->backend = new opencl_backend(
+        0, state.quiet, config.devices, config.platform,
+        const_cast<char*>(e->kernel_path.c_str()));
+
+    // The engine stays cached under the requested variant, `tuned` included.
+    std::string variant = config.variant;
+    apply_tuning(e->backend->devices[0].build_key, state.quiet, variant,
+        e->local_size, e->workset_size, e->global_size);
+    if (!e->backend->set_kernel_variant(variant)) {
+        std::cerr << "Unknown kernel variant " << variant << ", using unrolled" << std::endl;
+    }
+
+    e->backend->prepare_search(e->global_size, e->local_size, e->workset_size);
+    e->backend->start_hashing(16 * 1024 * 1024, 256 * 1024);
+    e->balancer = new load_balancer(
+        e->backend->devices.size(), e->global_size, e->local_size, state.quiet);
+    e->balancer->set_wave_sizes(e->backend->wave_sizes());
+    e->balancer->set_cotenant(state.max_launch_ms, state.duty_cycle);
+
+    auto t_end = std::chrono::high_resolution_clock::now();
+    if (!state.quiet) std::cerr << "Engine ready in "
+        << std::chrono::duration<double, std::milli>(t_end - t_start).count() << " ms (discovery "
+        << e->backend->discovery_ms << " ms, context " << e->backend->context_ms << " ms, build "
+        << e->backend->build_ms << " ms)" << std::endl;
+
+    state.engines[config.key()] = e;
+    return e;
+}
+
+// Passes a search that has covered [start_nonce, cursor) to the replacement
+// daemon, along with the client's connection.
+void hand_off_search(daemon_state& state, int fd, const search_request& request) {
+    char line[256];
+    snprintf(line, sizeof(line), " %016" PRIx64 " %016" PRIx64 " %" PRIu64 " %.1f %d %d ",
+        request.start_nonce, request.cursor, request.hashes, request.elapsed_ms,
+        request.shared, request.verbose);
+    std::string job = "job " + request.config.fields() + line
+        + request.target + " " + std::to_string(request.block_size);
+
+    std::lock_guard<std::mutex> lock(state.handoff_mutex);
+    if (!write_line_fd(state.handoff_fd, job, fd) || !write_all(state.handoff_fd, request.block, request.block_size)) {
+        std::cerr << "Handoff failed, dropping a search" << std::endl;
+        return;
+    }
+    if (!state.quiet) std::cerr << "Handed off a search at nonce " << std::hex << request.cursor << std::dec << std::endl;
+}
+
+void serve_search(daemon_state& state, int fd, search_request& request) {
+    engine* e = get_engine(state, request.config);
+    std::lock_guard<std::mutex> lock(e->mutex);
+
+    // chainweb-miner kills the client when new work arrives; stop searching
+    // for it as soon as its connection goes away.
+    if (peer_closed(fd)) return;
+    if (state.handing_off) {
+        hand_off_search(state, fd, request);
+        return;
+    }
+
+    auto t_start = std::chrono::high_resolution_clock::now();
+    e->backend->set_search_job(request.block, request.target_hash);
+
+    nonce_coordinator* coordinator = nullptr;
+    if (request.shared) {
+        coordinator = new nonce_coordinator(
+            request.target_hash, request.block, request.block_size, request.start_nonce, request.verbose == 0);
+    }
+
+    search_job job;
+    job.block_data = request.block;
+    job.block_size = request.block_size;
+    job.target_hash = request.target_hash;
+    job.start_nonce = request.cursor;
+    job.workset_size = e->workset_size;
+    job.coordinator = coordinator;
+    job.quiet = request.verbose == 0;
+    daemon_state* s = &state;
+    job.cancelled = [fd, s]() { return s->handing_off || peer_closed(fd); };
+    job.hash_share = state.hash_share;
+    job.tolerate_bad_nonces = true;
+
+    search_result result = run_search(*e->backend, *e->balancer, job);
+    delete coordinator;
+    if (e->balancer->cotenant()) e->balancer->print_cotenant_report();
+
+    // Hashing jobs queued during the search must not wait for the next one.
+    for (size_t device = 0; device < e->backend->devices.size(); device++) {
+        e->backend->service_hashing(device, 1.0);
+    }
+
+    auto t_end = std::chrono::high_resolution_clock::now();
+    request.hashes += result.hashes;
+    request.elapsed_ms += std::chrono::duration<double, std::milli>(t_end - t_start).count();
+
+    if (!result.found) {
+        if (state.handing_off && !peer_closed(fd)) {
+            request.cursor = result.next_nonce;
+            hand_off_search(state, fd, request);
+        } else if (!state.quiet) {
+            std::cerr << "Search cancelled by client" << std::endl;
+        }
+        return;
+    }
+
+    char reply[128];
+    snprintf(reply, sizeof(reply), "found %016" PRIx64 " %" PRIu64 " %" PRIu64,
+        result.nonce, request.hashes, (uint64_t) (request.hashes / (request.elapsed_ms / 1000)));
+    write_line(fd, reply);
+}
+
+void handle_search(daemon_state& state, int fd, std::istringstream& line) {
+    search_request request;
+    std::string nonce;
+    bool ok = request.config.read(line, state.defaults);
+    line >> nonce >> request.shared >> request.verbose >> request.target >> request.block_size;
+    if (!ok || !line || request.target.size() != 64
+        || request.block_size < 320 - 64 + 1 || request.block_size > 320) {
+        write_line(fd, "error malformed search request");
+        return;
+    }
+
+    memset(request.block, 0, sizeof(request.block));
+    if (!read_exact(fd, request.block, request.block_size)) return;
+    decode_target(request);
+
+    request.start_nonce = 0;
+    if (nonce != "-") {
+        request.start_nonce = std::stoull(nonce, 0, 16);
+    } else {
+        FILE* urandom = fopen("/dev/urandom","rb");
+        fread(&request.start_nonce, 1, 8, urandom);
+        fclose(urandom);
+    }
+    request.cursor = request.start_nonce;
+    request.hashes = 0;
+    request.elapsed_ms = 0;
+
+    serve_search(state, fd, request);
+}
+
+void handle_hash(daemon_state& state, int fd, std::istringstream& request) {
+    size_t count, bytes;
+    request >> count >> bytes;
+    if (!request) {
+        write_line(fd, "error malformed hash request");
+        return;
+    }
+
+    std::vector<uint32_t> offsets(count + 1);
+    std::vector<uint8_t> data(bytes);
+    if (!read_exact(fd, offsets.data(), offsets.size() * sizeof(uint32_t))) return;
+    if (!read_exact(fd, data.data(), data.size())) return;
+    if (offsets[0] != 0 || offsets[count] != bytes) {
+        write_line(fd, "error malformed offsets");
+        return;
+    }
+    for (size_t k = 0; k < count; k++) {
+        if (offsets[k] > offsets[k + 1]) {
+            write_line(fd, "error malformed offsets");
+            return;
+        }
+    }
+
+    engine* e;
+    {
+        std::lock_guard<std::mutex> lock(state.engines_mutex);
+        e = state.engines.empty() ? nullptr : state.engines.begin()->second;
+    }
+    if (e == nullptr) e = get_engine(state, state.defaults);
+    if (!e->backend->hashable(offsets.data(), count)) {
+        write_line(fd, "error message exceeds the hashing batch size");
+        return;
+    }
+
+    // The messages are split evenly between the engine's devices, as with -H.
+    std::vector<uint8_t> digests(32 * count);
+    size_t device_count = e->backend->devices.size();
+    if (e->mutex.try_lock()) {
+        std::vector<std::thread> hashers;
+        for (size_t d = 0; d < device_count; d++) {
+            size_t first = count * d / device_count;
+            size_t last = count * (d + 1) / device_count;
+            hashers.push_back(std::thread([&, d, first, last]() {
+                e->backend->hash_messages(data.data(), offsets.data() + first, last - first, digests.data() + 32 * first, d);
+            }));
+        }
+        for (std::thread& hasher : hashers) hasher.join();
+        e->mutex.unlock();
+    } else {
+        // A search is running; each device picks a part up between launches.
+        std::vector<hash_job> jobs(device_count);
+        std::vector<std::future<void> > done;
+        for (size_t d = 0; d < device_count; d++) {
+            size_t first = count * d / device_count;
+            jobs[d].data = data.data();
+            jobs[d].offsets = offsets.data() + first;
+            jobs[d].count = count * (d + 1) / device_count - first;
+            jobs[d].digests = digests.data() + 32 * first;
+            done.push_back(jobs[d].done.get_future());
+            e->backend->submit_hashes(&jobs[d]);
+        }
+
+        for (std::future<void>& part : done) {
+            while (part.wait_for(std::chrono::milliseconds(100)) != std::future_status::ready) {
+                if (e->mutex.try_lock()) {
+                    for (size_t d = 0; d < device_count; d++) e->backend->service_hashing(d, 1.0);
+                    e->mutex.unlock();
+                }
+            }
+        }
+    }
+
+    write_line(fd, "digests " + std::to_string(count));
+    write_all(fd, digests.data(), digests.size());
+}
+
+void handle_cotenant(daemon_state& state, int fd, std::istringstream& request) {
+    double max_launch_ms, duty_percent;
+    request >> max_launch_ms >> duty_percent;
+    if (!request || max_launch_ms < 0 || duty_percent <= 0 || duty_percent > 100) {
+        write_line(fd, "error malformed cotenant request");
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(state.engines_mutex);
+    state.max_launch_ms = max_launch_ms;
+    state.duty_cycle = duty_percent / 100.0;
+    for (std::map<std::string, engine*>::value_type& it : state.engines) {
+        it.second->balancer->set_cotenant(state.max_launch_ms, state.duty_cycle);
+    }
+    std::cerr << "Co-tenant mode: launches up to " << max_launch_ms << " ms, duty cycle "
+              << duty_percent << "%" << std::endl;
+    write_line(fd, "ok");
+}
+
+// The old side of a handoff to a daemon started with -R, see daemon_socket.hpp.
+void handle_handoff(daemon_state& state, int fd) {
+    {
+        std::lock_guard<std::mutex> lock(state.engines_mutex);
+        char cotenant[64];
+        snprintf(cotenant, sizeof(cotenant), "cotenant %g %g", state.max_launch_ms, 100 * state.duty_cycle);
+        write_line(fd, cotenant);
+        for (std::map<std::string, engine*>::value_type& it : state.engines) {
+            write_line(fd, "engine " + it.second->config.fields());
+        }
+        write_line(fd, "end");
+    }
+
+    // Keep mining while the new daemon builds its engines.
+    std::string line;
+    if (!read_line(fd, line) || line != "go") {
+        std::cerr << "Replacement daemon went away, carrying on" << std::endl;
+        return;
+    }
+    std::cerr << "Handing off to the replacement daemon" << std::endl;
+
+    {
+        std::lock_guard<std::mutex> lock(state.handoff_mutex);
+        state.handoff_fd = fd;
+        state.handing_off = true;
+    }
+    shutdown(state.listener, SHUT_RDWR);
+
+    // Searches hand themselves off as they notice; hashing finishes here.
+    std::unique_lock<std::mutex> lock(state.connections_mutex);
+    state.connections_cv.wait(lock, [&]() { return !state.accepting && state.connections == 1; });
+    write_line(fd, "done");
+    state.handed_off = true;
+    state.connections_cv.notify_all();
+}
+
+void resume_search(daemon_state* state, int fd, search_request* request) {
+    serve_search(*state, fd, *request);
+    delete request;
+    close(fd);
+    connection_closed(*state);
+}
+
+// The new side of a handoff: resumes the searches of the old daemon.
+void receive_handoff(daemon_state* state, int fd) {
+    std::string line;
+    size_t jobs = 0;
+    while (true) {
+        int client = -1;
+        if (!read_line_fd(fd, line, client)) {
+            std::cerr << "Old daemon went away during the handoff" << std::endl;
+            break;
+        }
+        std::istringstream in(line);
+        std::string command;
+        in >> command;
+        if (command == "done") {
+            std::cerr << "Handoff complete, resumed " << jobs << " search(es)" << std::endl;
+            break;
+        }
+
+        search_request* request = new search_request();
+        std::string start, cursor;
+        bool ok = command == "job" && request->config.read(in, state->defaults);
+        in >> start >> cursor >> request->hashes >> request->elapsed_ms >> request->shared
+           >> request->verbose >> request->target >> request->block_size;
+        ok = ok && in && client >= 0 && request->target.size() == 64
+            && request->block_size >= 320 - 64 + 1 && request->block_size <= 320
+            && read_exact(fd, request->block, request->block_size);
+        if (!ok) {
+            std::cerr << "Malformed handoff line: " << line << std::endl;
+            if (client >= 0) close(client);
+            delete request;
+            break;
+        }
+        decode_target(*request);
+        request->start_nonce = std::stoull(start, 0, 16);
+        request->cursor = std::stoull(cursor, 0, 16);
+
+        jobs++;
+        connection_opened(*state);
+        std::thread(resume_search, state, client, request).detach();
+    }
+    close(fd);
+    connection_closed(*state);
+}
+
+// Builds the engines of the daemon on the socket, connected on `fd`, before
+// this one takes over from it.
+bool prepare_takeover(daemon_state& state, int fd) {
+    if (!write_line(fd, "handoff")) return false;
+    std::string line;
+    while (read_line(fd, line)) {
+        std::istringstream in(line);
+        std::string command;
+        in >> command;
+        if (command == "end") return true;
+        if (command == "cotenant") {
+            double duty_percent;
+            in >> state.max_launch_ms >> duty_percent;
+            state.duty_cycle = duty_percent / 100.0;
+        } else if (command == "engine") {
+            engine_config config;
+            if (config.read(in, state.defaults)) get_engine(state, config);
+        } else {
+            std::cerr << "Old daemon: " << line << std::endl;
+            return false;
+        }
+    }
+    return false;
+}
+
+void handle_connection(daemon_state* state, int fd) {
+    std::string line;
+    if (read_line(fd, line)) {
+        std::istringstream request(line);
+        std::string command;
+        request >> command;
+        if (command == "search") {
+            handle_search(*state, fd, request);
+        } else if (command == "hash") {
+            handle_hash(*state, fd, request);
+        } else if (command == "cotenant") {
+            handle_cotenant(*state, fd, request);
+        } else if (command == "handoff" && !state->handing_off) {
+            handle_handoff(*state, fd);
+        } else {
+            write_line(fd, "error unknown command " + command);
+        }
+    }
+    close(fd);
+    connection_closed(*state);
+}
+
+int main(int argc, char* const* argv) {
+    daemon_state state;
+    state.defaults.platform = -1;
+    state.defaults.devices.assign(1, 0);
+    state.defaults.local_size = 256;
+    state.defaults.workset_size = 64;
+    state.defaults.global_size = 1024 * 1024 * 16;
+    state.defaults.kernel_path = "kernels/kernel.cl";
+    state.defaults.variant = "unrolled";
+    state.hash_share = 0;
+    state.max_launch_ms = 0;
+    state.duty_cycle = 1;
+    state.quiet = true;
+    state.connections = 0;
+    state.listener = -1;
+    state.handing_off = false;
+    state.handoff_fd = -1;
+    state.accepting = true;
+    state.handed_off = false;
+    bool takeover = false;
+    std::string stats_address;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "d:p:l:w:g:k:V:S:c:u:M:Rvh")) != -1) {
+      switch(opt) {
+        case 'd': state.defaults.devices = parse_int_list(optarg); break;
+        case 'p': state.defaults.platform = std::stoi(optarg); break;
+        case 'l': state.defaults.local_size = std::stoi(optarg); break;
+        case 'w': state.defaults.workset_size = std::stoi(optarg); break;
+        case 'g': state.defaults.global_size = std::stoi(optarg); break;
+        case 'k': state.defaults.kernel_path = optarg; break;
+        case 'V': state.defaults.variant = optarg; break;
+        case 'S': state.hash_share = std::stod(optarg) / 100.0; break;
+        case 'c': state.max_launch_ms = std::stod(optarg); break;
+        case 'u': state.duty_cycle = std::stod(optarg) / 100.0; break;
+        case 'M': stats_address = optarg; break;
+        case 'R': takeover = true; break;
+        case 'v': state.quiet = false; break;
+        case 'h':
+        case '?':
+          usage();
+          exit(1);
+      }
+    }
+
+    get_engine(state, state.defaults);
+
+    if (!stats_address.empty()) {
+        int stats = listen_stats(stats_address);
+        if (stats < 0) {
+            std::cerr << "Cannot serve stats on " << stats_address << ": " << strerror(errno) << std::endl;
+            exit(1);
+        }
+        daemon_state* s = &state;
+        serve_stats(stats, [s]() { return engine_stats(*s); });
+        std::cerr << "Serving stats on " << stats_address << std::endl;
+    }
+
+    std::string path = daemon_socket_path();
+    int old = -1;
+    if (takeover) {
+        old = connect_daemon(path);
+        if (old < 0) {
+            std::cerr << "No daemon to take over on " << path << ", starting afresh" << std::endl;
+        } else if (!prepare_takeover(state, old)) {
+            std::cerr << "Cannot take over from the daemon on " << path << std::endl;
+            exit(1);
+        }
+    }
+
+    // A replacement listens on a fresh path and renames it over the old one,
+    // so that no client finds the socket missing.
+    std::string listen_path = old >= 0 ? path + ".new" : path;
+    state.listener = listen_daemon(listen_path);
+    if (state.listener < 0 || (old >= 0 && rename(listen_path.c_str(), path.c_str()) != 0)) {
+        std::cerr << "Cannot listen on " << path << ": " << strerror(errno) << std::endl;
+        exit(1);
+    }
+    std::cerr << "Listening on " << path << std::endl;
+
+    if (old >= 0) {
+        write_line(old, "go");
+        connection_opened(state);
+        std::thread(receive_handoff, &state, old).detach();
+    }
+
+    int accept_error = 0;
+    while (!state.handing_off) {
+        int fd = accept(state.listener, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED || state.handing_off) continue;
+            // Errors such as EMFILE last until connections close: say so once
+            // and retry at a slow pace instead of spinning.
+            if (errno != accept_error) {
+                accept_error = errno;
+                std::cerr << "Cannot accept connections: " << strerror(errno) << std::endl;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            continue;
+        }
+        accept_error = 0;
+        connection_opened(state);
+        std::thread(handle_connection, &state, fd).detach();
+    }
+
+    // The socket path belongs to the replacement now.
+    std::unique_lock<std::mutex> lock(state.connections_mutex);
+    state.accepting = false;
+    state.connections_cv.notify_all();
+    state.connections_cv.wait(lock, [&]() { return state.handed_off; });
+    std::cerr << "Handed off, exiting" << std::endl;
+    return 0;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// Unix socket plumbing shared by chungusd and chungus-client.
+//
+// Requests and replies are a single text line, optionally followed by a
+// binary payload whose size the line announces:
+//
+//   search <platform> <devices> <local> <workset> <global> <kernel|-> <variant|->
+//          <nonce|-> <shared> <verbose> <target> <block size>\n<block>
+//     -> found <nonce> <hashes> <hashrate>\n | error <message>\n
+//
+//   cotenant <max launch ms> <duty cycle %>
+//     -> ok\n | error <message>\n
+//
+//   hash <count> <bytes>\n<count + 1 uint32 offsets><data>
+//     -> digests <count>\n<32 * count bytes> | error <message>\n
+//
+//   handoff, sent by a daemon started with -R to the one it replaces
+//     -> cotenant <max launch ms> <duty cycle %>\n
+//        engine <platform> <devices> <local> <workset> <global> <kernel> <variant>\n ...
+//        end\n
+//   go, once the new daemon has built those engines and owns the socket path
+//     -> job <platform> <devices> <local> <workset> <global> <kernel> <variant>
+//            <start nonce> <cursor> <hashes> <elapsed ms> <shared> <verbose>
+//            <target> <block size>\n<block> ...
+//        done\n
+//   Each job line carries the client's connection (SCM_RIGHTS); the new
+//   daemon resumes the search at the cursor and answers the client on it.
+
+// $BIGOLCHUNGUS_SOCKET, or a per-user path in /tmp.
+std::string daemon_socket_path();
+
+int connect_daemon(const std::string& path);
+int listen_daemon(const std::string& path);
+
+bool read_line(int fd, std::string& line);
+bool read_exact(int fd, void* data, size_t size);
+bool write_all(int fd, const void* data, size_t size);
+bool write_line(int fd, const std::string& line);
+
+// A line that also passes the descriptor `passed` to the peer, and its
+// counterpart, which sets `passed` to a received descriptor or leaves it.
+bool write_line_fd(int fd, const std::string& line, int passed);
+bool read_line_fd(int fd, std::string& line, int& passed);
+
+// True once the peer has closed its end of the connection.
+bool peer_closed(int fd);
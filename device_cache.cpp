@@ -0,0 +1,196 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <dlfcn.h>
+#include <sys/stat.h>
+
+#include "device_cache.hpp"
+
+// Vendor queries for the PCI location of a device, from cl_ext.h.
+#define CL_DEVICE_PCI_BUS_INFO_KHR 0x410F
+#define CL_DEVICE_PCI_BUS_ID_NV 0x4008
+#define CL_DEVICE_PCI_SLOT_ID_NV 0x4009
+#define CL_DEVICE_PCI_DOMAIN_ID_NV 0x400A
+#define CL_DEVICE_TOPOLOGY_AMD 0x4037
+
+namespace detail {
+    std::string platformString(cl_platform_id id, cl_platform_info param) {
+        size_t size = 0;
+        clGetPlatformInfo(id, param, 0, nullptr, &size);
+        std::string result(size, '\0');
+        clGetPlatformInfo(id, param, size, const_cast<char*>(result.data()), nullptr);
+        if (!result.empty() && result.back() == '\0') result.pop_back();
+        return result;
+    }
+
+    std::string deviceString(cl_device_id id, cl_device_info param) {
+        size_t size = 0;
+        clGetDeviceInfo(id, param, 0, nullptr, &size);
+        std::string result(size, '\0');
+        clGetDeviceInfo(id, param, size, const_cast<char*>(result.data()), nullptr);
+        if (!result.empty() && result.back() == '\0') result.pop_back();
+        return result;
+    }
+
+    // Whether `param` of `id` is exactly `size` bytes, read into `value`.
+    bool deviceValue(cl_device_id id, cl_device_info param, size_t size, void* value) {
+        size_t actual = 0;
+        return clGetDeviceInfo(id, param, size, value, &actual) == CL_SUCCESS && actual == size;
+    }
+
+    std::string pciBusId(cl_device_id id) {
+        unsigned domain = 0, bus = 0, device = 0, function = 0;
+        cl_uint khr[4];
+        cl_uint nv_bus, nv_slot, nv_domain;
+        union {
+            struct { cl_uint type; cl_uint data[5]; } raw;
+            struct { cl_uint type; cl_uchar unused[17]; cl_uchar bus; cl_uchar device; cl_uchar function; } pcie;
+        } amd;
+
+        if (deviceValue(id, CL_DEVICE_PCI_BUS_INFO_KHR, sizeof(khr), khr)) {
+            domain = khr[0]; bus = khr[1]; device = khr[2]; function = khr[3];
+        } else if (deviceValue(id, CL_DEVICE_PCI_BUS_ID_NV, sizeof(nv_bus), &nv_bus)
+                && deviceValue(id, CL_DEVICE_PCI_SLOT_ID_NV, sizeof(nv_slot), &nv_slot)) {
+            if (deviceValue(id, CL_DEVICE_PCI_DOMAIN_ID_NV, sizeof(nv_domain), &nv_domain)) domain = nv_domain;
+            bus = nv_bus; device = nv_slot >> 3; function = nv_slot & 7;
+        } else if (deviceValue(id, CL_DEVICE_TOPOLOGY_AMD, sizeof(amd), &amd) && amd.raw.type == 1) {
+            bus = amd.pcie.bus; device = amd.pcie.device; function = amd.pcie.function;
+        } else {
+            return "-";
+        }
+
+        char text[32];
+        snprintf(text, sizeof(text), "%04x:%02x:%02x.%x", domain, bus, device, function);
+        return text;
+    }
+
+    // The ICD loader hands out the vendor's own platform objects, whose first
+    // member points to the vendor's dispatch table; the library that holds
+    // the table is the ICD.
+    std::string icdLibrary(cl_platform_id id) {
+#ifdef __APPLE__
+        return "-";
+#else
+        void* dispatch = id != nullptr ? *(void**) id : nullptr;
+        Dl_info info;
+        if (dispatch == nullptr || dladdr(dispatch, &info) == 0 || info.dli_fname == nullptr) return "-";
+        std::string library = info.dli_fname;
+        if (library.find("libOpenCL.so") != std::string::npos) return "-";
+        return library;
+#endif
+    }
+
+    std::vector<std::string> splitTabs(const std::string& line) {
+        std::vector<std::string> fields;
+        std::istringstream in(line);
+        std::string field;
+        while (std::getline(in, field, '\t')) fields.push_back(field);
+        return fields;
+    }
+
+    void makeParents(const std::string& path) {
+        for (size_t slash = path.find('/', 1); slash != std::string::npos; slash = path.find('/', slash + 1)) {
+            mkdir(path.substr(0, slash).c_str(), 0755);
+        }
+    }
+};
+
+bool device_fingerprint::matches(const device_fingerprint& other) const {
+    if (pci_bus != "-" && other.pci_bus != "-") return pci_bus == other.pci_bus;
+    return name == other.name && vendor == other.vendor && driver == other.driver;
+}
+
+bool platform_fingerprint::matches(const platform_fingerprint& other) const {
+    return name == other.name && vendor == other.vendor && version == other.version;
+}
+
+std::string device_cache_path() {
+    const char* path = getenv("BIGOLCHUNGUS_DEVICE_CACHE");
+    return path != nullptr ? path : "";
+}
+
+bool load_device_cache(const std::string& path, std::vector<platform_fingerprint>& platforms) {
+    std::ifstream in(path.c_str());
+    if (!in) return false;
+    platforms.clear();
+    std::string line;
+    while (std::getline(in, line)) {
+        std::vector<std::string> fields = detail::splitTabs(line);
+        if (fields.size() == 5 && fields[0] == "platform") {
+            platform_fingerprint platform = { fields[1], fields[2], fields[3], fields[4], std::vector<device_fingerprint>() };
+            platforms.push_back(platform);
+        } else if (fields.size() == 5 && fields[0] == "device" && !platforms.empty()) {
+            device_fingerprint device = { fields[1], fields[2], fields[3], fields[4] };
+            platforms.back().devices.push_back(device);
+        } else {
+            return false;
+        }
+    }
+    return !platforms.empty();
+}
+
+bool store_device_cache(const std::string& path, const std::vector<platform_fingerprint>& platforms) {
+    detail::makeParents(path);
+    std::string tmp = path + ".tmp";
+    {
+        std::ofstream out(tmp.c_str());
+        for (const platform_fingerprint& platform : platforms) {
+            out << "platform\t" << platform.name << "\t" << platform.vendor << "\t"
+                << platform.version << "\t" << platform.icd_library << "\n";
+            for (const device_fingerprint& device : platform.devices) {
+                out << "device\t" << device.name << "\t" << device.vendor << "\t"
+                    << device.driver << "\t" << device.pci_bus << "\n";
+            }
+        }
+        if (!out) return false;
+    }
+    return rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+platform_fingerprint fingerprint_platform(cl_platform_id platform) {
+    platform_fingerprint result;
+    result.name = detail::platformString(platform, CL_PLATFORM_NAME);
+    result.vendor = detail::platformString(platform, CL_PLATFORM_VENDOR);
+    result.version = detail::platformString(platform, CL_PLATFORM_VERSION);
+    result.icd_library = detail::icdLibrary(platform);
+
+    cl_uint count = 0;
+    clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, 0, nullptr, &count);
+    std::vector<cl_device_id> devices(count);
+    if (count > 0) clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, count, devices.data(), nullptr);
+    for (cl_device_id device : devices) result.devices.push_back(fingerprint_device(device));
+    return result;
+}
+
+device_fingerprint fingerprint_device(cl_device_id device) {
+    device_fingerprint result;
+    result.name = detail::deviceString(device, CL_DEVICE_NAME);
+    result.vendor = detail::deviceString(device, CL_DEVICE_VENDOR);
+    result.driver = detail::deviceString(device, CL_DRIVER_VERSION);
+    result.pci_bus = detail::pciBusId(device);
+    return result;
+}
+
+bool restrict_icd_loading(const std::string& cache_path, const std::string& library) {
+    if (library.empty() || library == "-") return false;
+    if (getenv("OCL_ICD_VENDORS") != nullptr || getenv("OCL_ICD_FILENAMES") != nullptr) return false;
+
+    // One directory per library, so that processes on different platforms
+    // never rewrite each other's.
+    std::string name = library.substr(library.rfind('/') + 1);
+    std::string dir = cache_path + ".icd/" + name;
+    detail::makeParents(dir + "/");
+    std::string file = dir + "/" + name + ".icd";
+    std::string tmp = file + ".tmp";
+    {
+        std::ofstream out(tmp.c_str());
+        out << library << "\n";
+        if (!out) return false;
+    }
+    if (rename(tmp.c_str(), file.c_str()) != 0) return false;
+    return setenv("OCL_ICD_VENDORS", dir.c_str(), 1) == 0;
+}
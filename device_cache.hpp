@@ -0,0 +1,54 @@
+#pragma once
+
+#ifdef __APPLE__
+    #define CL_SILENCE_DEPRECATION
+    #include <OpenCL/opencl.h>
+#else
+    #include "CL/cl.h"
+#endif
+
+#include <string>
+#include <vector>
+
+// Fingerprints of the OpenCL platforms and devices of this host. With a cache
+// in place a process only loads the ICD of the platform it uses, instead of
+// every installed one, and finds its platform and devices by identity.
+//
+// Tab separated, each platform followed by its devices in enumeration order:
+//   platform <name> <vendor> <version> <icd library>
+//   device <name> <vendor> <driver version> <pci bus id>
+// Unknown ICD libraries and PCI bus ids are `-`.
+struct device_fingerprint {
+    std::string name;
+    std::string vendor;
+    std::string driver;
+    std::string pci_bus;
+
+    // The same physical device: the same bus id where both have one.
+    bool matches(const device_fingerprint& other) const;
+};
+
+struct platform_fingerprint {
+    std::string name;
+    std::string vendor;
+    std::string version;
+    std::string icd_library;
+    std::vector<device_fingerprint> devices;
+
+    bool matches(const platform_fingerprint& other) const;
+};
+
+// $BIGOLCHUNGUS_DEVICE_CACHE; empty, and the cache unused, if not set.
+std::string device_cache_path();
+
+bool load_device_cache(const std::string& path, std::vector<platform_fingerprint>& platforms);
+bool store_device_cache(const std::string& path, const std::vector<platform_fingerprint>& platforms);
+
+platform_fingerprint fingerprint_platform(cl_platform_id platform);
+device_fingerprint fingerprint_device(cl_device_id device);
+
+// Makes the ICD loader load only `library`, by pointing OCL_ICD_VENDORS at a
+// directory next to the cache that lists only it. Must run before the first
+// OpenCL call. Leaves a restriction the user set with OCL_ICD_VENDORS or
+// OCL_ICD_FILENAMES alone. Returns whether it restricted loading.
+bool restrict_icd_loading(const std::string& cache_path, const std::string& library);
@@ -0,0 +1,287 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+#include "http_client.hpp"
+
+// chungus-farm: scrapes GET /stats of every rig (chungusd or chungus-native
+// started with -M, see stats_server.hpp) and ranks the devices that fall
+// short of the baseline in their own tuning database entry.
+
+void usage() {
+  fprintf(
+    stderr,
+    "  chungus-farm [ -f <rig file>          ]\n"
+    "               [ -t <threshold %%>       ]\n"
+    "               [ -e <error rate %%>      ]\n"
+    "               [ -T <timeout ms>        ]\n"
+    "               [ -a                     ]\n"
+    "               [ <host:port> ...        ]\n\n"
+    "  Scrapes the live statistics of every rig, as served by `chungusd -M` and\n"
+    "  `chungus-native -M`, and prints the devices that fall short of the\n"
+    "  baseline that `chungus-bench -A` recorded for them on that rig, worst\n"
+    "  first. Unreachable rigs come first, then devices reporting bad nonces,\n"
+    "  then the lowest hashrate against the baseline.\n\n"
+    "    -f <rig file>\n"
+    "      One host:port per line, `#` starts a comment. Adds to the rigs given\n"
+    "      as arguments.\n\n"
+    "    -t <threshold %%>\n"
+    "      Default `90`. A device is underperforming below this share of its\n"
+    "      tuned hashrate, or when its launches take longer than the tuned rate\n"
+    "      allows by the same margin.\n\n"
+    "    -e <error rate %%>\n"
+    "      Default `0`. Share of launches that may return a nonce that fails\n"
+    "      verification on the host.\n\n"
+    "    -T <timeout ms>\n"
+    "      Default `3000`, per rig. Rigs are scraped in parallel.\n\n"
+    "    -a\n"
+    "      Ranks every device, not only the underperforming ones.\n\n"
+    "  Throttling devices are always reported; devices without a tuning entry\n"
+    "  only for throttling and bad nonces. A device whose driver changed since\n"
+    "  it was tuned is held to its last entry and flagged. Exits with 2 if\n"
+    "  anything was reported as underperforming.\n\n"
+  );
+}
+
+// One line of a rig's /stats reply, see stats_server.hpp.
+struct device_stats {
+    std::string rig;
+    std::string device;
+    std::string variant;
+    size_t launch_size;
+    size_t workset_size;
+    uint64_t launches;
+    uint64_t hashes;
+    double rate;            // H/s
+    double launch_ms;
+    double max_launch_ms;
+    uint64_t errors;
+    bool throttled;
+    double tuned_rate;      // H/s, 0 without a tuning entry
+    std::string tuned_variant;
+    size_t tuned_global_size;
+    bool driver_changed;    // tuned under another driver than the one running
+    std::string build_key;
+
+    bool reachable;         // false for the placeholder of a rig that did not answer
+    std::string problem;    // why it did not
+};
+
+// How a device compares with its baseline.
+struct device_rank {
+    device_stats stats;
+    double rate_ratio;      // live / tuned hashrate, 0 without a baseline
+    double expected_ms;     // launch duration at the tuned hashrate, 0 without one
+    double error_rate;      // bad nonces per launch
+    std::vector<std::string> flags;
+    bool underperforming;
+};
+
+namespace detail {
+    // Launches before the moving averages mean anything, as in load_balancer.
+    const uint64_t MIN_LAUNCHES = 4;
+
+    bool parseDevice(const std::string& line, device_stats& stats) {
+        std::istringstream in(line);
+        std::string kind;
+        int throttled, driver_changed;
+        in >> kind >> stats.device >> stats.variant >> stats.launch_size >> stats.workset_size
+           >> stats.launches >> stats.hashes >> stats.rate >> stats.launch_ms >> stats.max_launch_ms
+           >> stats.errors >> throttled >> stats.tuned_rate >> stats.tuned_variant
+           >> stats.tuned_global_size >> driver_changed;
+        if (!in || kind != "device") return false;
+        std::getline(in, stats.build_key);
+        if (!stats.build_key.empty() && stats.build_key[0] == ' ') stats.build_key.erase(0, 1);
+        stats.throttled = throttled != 0;
+        stats.driver_changed = driver_changed != 0;
+        stats.reachable = true;
+        return true;
+    }
+
+    std::vector<device_stats> scrapeRig(const std::string& rig, int timeout_ms) {
+        std::vector<device_stats> devices;
+        device_stats unreachable = device_stats();
+        unreachable.rig = rig;
+        unreachable.reachable = false;
+
+        http_response response = http_request(rig, "GET", "/stats", "text/plain", "", timeout_ms);
+        if (response.status != 200) {
+            unreachable.problem = response.status == 0
+                ? "no answer" : "HTTP " + std::to_string(response.status);
+            return std::vector<device_stats>(1, unreachable);
+        }
+
+        std::istringstream body(response.body);
+        std::string line;
+        bool complete = false;
+        while (std::getline(body, line)) {
+            if (line == "end") {
+                complete = true;
+                break;
+            }
+            device_stats stats;
+            if (!parseDevice(line, stats)) continue;
+            stats.rig = rig;
+            devices.push_back(stats);
+        }
+        if (!complete) {
+            unreachable.problem = "truncated reply";
+            return std::vector<device_stats>(1, unreachable);
+        }
+        return devices;
+    }
+
+    device_rank rankDevice(const device_stats& stats, double threshold, double max_error_rate) {
+        device_rank rank;
+        rank.stats = stats;
+        rank.rate_ratio = 0;
+        rank.expected_ms = 0;
+        rank.error_rate = 0;
+        rank.underperforming = false;
+
+        if (!stats.reachable) {
+            rank.flags.push_back("unreachable (" + stats.problem + ")");
+            rank.underperforming = true;
+            return rank;
+        }
+        if (stats.launches > 0) rank.error_rate = (double) stats.errors / stats.launches;
+        if (stats.errors > 0 && rank.error_rate > max_error_rate) {
+            rank.flags.push_back("bad nonces");
+            rank.underperforming = true;
+        }
+        if (stats.launches < MIN_LAUNCHES) {
+            rank.flags.push_back("idle");
+            return rank;
+        }
+        if (stats.throttled) {
+            rank.flags.push_back("throttled");
+            rank.underperforming = true;
+        }
+        if (stats.tuned_rate <= 0) {
+            rank.flags.push_back("untuned");
+            return rank;
+        }
+
+        if (stats.driver_changed) rank.flags.push_back("driver changed");
+        rank.rate_ratio = stats.rate / stats.tuned_rate;
+        rank.expected_ms = stats.launch_size * stats.workset_size / stats.tuned_rate * 1000;
+        if (rank.rate_ratio < threshold) {
+            rank.flags.push_back("slow");
+            rank.underperforming = true;
+        }
+        if (stats.launch_ms * threshold > rank.expected_ms) {
+            rank.flags.push_back("long launches");
+            rank.underperforming = true;
+        }
+        if (stats.variant != stats.tuned_variant) rank.flags.push_back("tuned for " + stats.tuned_variant);
+        return rank;
+    }
+
+    // Unreachable rigs, then bad nonces, then the largest shortfall.
+    bool worseThan(const device_rank& a, const device_rank& b) {
+        if (a.stats.reachable != b.stats.reachable) return !a.stats.reachable;
+        bool a_errors = a.stats.errors > 0, b_errors = b.stats.errors > 0;
+        if (a_errors != b_errors) return a_errors;
+        if (a_errors && a.error_rate != b.error_rate) return a.error_rate > b.error_rate;
+        if (a.stats.throttled != b.stats.throttled) return a.stats.throttled;
+        double a_ratio = a.rate_ratio > 0 ? a.rate_ratio : 1;
+        double b_ratio = b.rate_ratio > 0 ? b.rate_ratio : 1;
+        if (a_ratio != b_ratio) return a_ratio < b_ratio;
+        return a.stats.rig + a.stats.device < b.stats.rig + b.stats.device;
+    }
+
+    void readRigFile(const char* path, std::vector<std::string>& rigs) {
+        std::ifstream in(path);
+        if (!in) {
+            fprintf(stderr, "Cannot read %s\n", path);
+            exit(1);
+        }
+        std::string line;
+        while (std::getline(in, line)) {
+            line = line.substr(0, line.find('#'));
+            std::istringstream fields(line);
+            std::string rig;
+            if (fields >> rig) rigs.push_back(rig);
+        }
+    }
+};
+
+int main(int argc, char* const* argv) {
+    std::vector<std::string> rigs;
+    double threshold = 0.9;
+    double max_error_rate = 0;
+    int timeout_ms = 3000;
+    bool all = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "f:t:e:T:ah")) != -1) {
+      switch(opt) {
+        case 'f': detail::readRigFile(optarg, rigs); break;
+        case 't': threshold = std::stod(optarg) / 100.0; break;
+        case 'e': max_error_rate = std::stod(optarg) / 100.0; break;
+        case 'T': timeout_ms = std::stoi(optarg); break;
+        case 'a': all = true; break;
+        case 'h':
+        case '?':
+          usage();
+          exit(1);
+      }
+    }
+    for (int i = optind; i < argc; i++) rigs.push_back(argv[i]);
+    if (rigs.empty()) {
+      usage();
+      exit(1);
+    }
+
+    std::vector<std::vector<device_stats> > scraped(rigs.size());
+    std::vector<std::thread> scrapers;
+    for (size_t r = 0; r < rigs.size(); r++) {
+        scrapers.push_back(std::thread([&, r]() { scraped[r] = detail::scrapeRig(rigs[r], timeout_ms); }));
+    }
+    for (std::thread& scraper : scrapers) scraper.join();
+
+    std::vector<device_rank> ranks;
+    size_t device_count = 0;
+    for (const std::vector<device_stats>& devices : scraped) {
+        for (const device_stats& stats : devices) {
+            if (stats.reachable) device_count++;
+            ranks.push_back(detail::rankDevice(stats, threshold, max_error_rate));
+        }
+    }
+    std::sort(ranks.begin(), ranks.end(), detail::worseThan);
+
+    size_t reported = 0;
+    printf("%-4s %-22s %-7s %-16s %10s %10s %7s %10s %10s %9s  %s\n",
+        "rank", "rig", "device", "variant", "MH/s", "tuned", "rate%", "launch ms", "expected", "errors%", "flags");
+    for (const device_rank& rank : ranks) {
+        if (!rank.underperforming && !all) continue;
+        if (rank.underperforming) reported++;
+
+        std::string flags;
+        for (const std::string& flag : rank.flags) flags += (flags.empty() ? "" : ", ") + flag;
+        const device_stats& s = rank.stats;
+        if (!s.reachable) {
+            printf("%-4zu %-22s %-7s %-16s %10s %10s %7s %10s %10s %9s  %s\n",
+                reported, s.rig.c_str(), "-", "-", "-", "-", "-", "-", "-", "-", flags.c_str());
+            continue;
+        }
+        char ratio[16] = "-", expected[16] = "-";
+        if (rank.rate_ratio > 0) snprintf(ratio, sizeof(ratio), "%.1f", 100 * rank.rate_ratio);
+        if (rank.expected_ms > 0) snprintf(expected, sizeof(expected), "%.2f", rank.expected_ms);
+        printf("%-4s %-22s %-7s %-16s %10.2f %10.2f %7s %10.2f %10s %9.3f  %s\n",
+            rank.underperforming ? std::to_string(reported).c_str() : "-",
+            s.rig.c_str(), s.device.c_str(), s.variant.c_str(), s.rate / 1e6, s.tuned_rate / 1e6,
+            ratio, s.launch_ms, expected, 100 * rank.error_rate, flags.c_str());
+    }
+    fflush(stdout);
+    fprintf(stderr, "%zu underperforming of %zu device(s) on %zu rig(s)\n",
+        reported, device_count, rigs.size());
+    return reported > 0 ? 2 : 0;
+}
@@ -0,0 +1,105 @@
+#include <cctype>
+#include <cstring>
+#include <string>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "http_client.hpp"
+
+namespace detail {
+    int connectTo(const std::string& address, int timeout_ms) {
+        size_t colon = address.rfind(':');
+        std::string host = colon == std::string::npos ? address : address.substr(0, colon);
+        std::string port = colon == std::string::npos ? "80" : address.substr(colon + 1);
+
+        addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* result = nullptr;
+        if (getaddrinfo(host.c_str(), port.c_str(), &hints, &result) != 0) return -1;
+
+        int fd = -1;
+        for (addrinfo* ai = result; ai != nullptr && fd < 0; ai = ai->ai_next) {
+            fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+            if (fd < 0) continue;
+
+            timeval tv = { timeout_ms / 1000, (timeout_ms % 1000) * 1000 };
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+            setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+            if (connect(fd, ai->ai_addr, ai->ai_addrlen) != 0) {
+                close(fd);
+                fd = -1;
+            }
+        }
+        freeaddrinfo(result);
+        return fd;
+    }
+
+    std::string decodeChunked(const std::string& body) {
+        std::string decoded;
+        size_t pos = 0;
+        while (pos < body.size()) {
+            size_t line_end = body.find("\r\n", pos);
+            if (line_end == std::string::npos) break;
+            size_t size = std::stoul(body.substr(pos, line_end - pos), nullptr, 16);
+            if (size == 0) break;
+            decoded.append(body, line_end + 2, size);
+            pos = line_end + 2 + size + 2;
+        }
+        return decoded;
+    }
+};
+
+http_response http_request(
+    const std::string& address,
+    const std::string& method,
+    const std::string& path,
+    const std::string& content_type,
+    const std::string& body,
+    int timeout_ms
+) {
+    http_response response = { 0, "" };
+    int fd = detail::connectTo(address, timeout_ms);
+    if (fd < 0) return response;
+
+    std::string request =
+        method + " " + path + " HTTP/1.1\r\n"
+        "Host: " + address + "\r\n"
+        "Connection: close\r\n"
+        "Content-Type: " + content_type + "\r\n"
+        "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+
+    const char* p = request.data();
+    size_t left = request.size();
+    while (left > 0) {
+        ssize_t n = send(fd, p, left, MSG_NOSIGNAL);
+        if (n <= 0) {
+            close(fd);
+            return response;
+        }
+        p += n;
+        left -= n;
+    }
+
+    // With Connection: close the body simply runs until EOF.
+    std::string raw;
+    char chunk[4096];
+    ssize_t n;
+    while ((n = recv(fd, chunk, sizeof(chunk), 0)) > 0) raw.append(chunk, n);
+    close(fd);
+
+    size_t header_end = raw.find("\r\n\r\n");
+    if (raw.compare(0, 5, "HTTP/") != 0 || header_end == std::string::npos) return response;
+
+    std::string headers = raw.substr(0, header_end);
+    for (char& c : headers) c = tolower(c);
+    response.status = std::stoi(raw.substr(raw.find(' ') + 1, 3));
+    response.body = raw.substr(header_end + 4);
+    if (headers.find("transfer-encoding: chunked") != std::string::npos) {
+        response.body = detail::decodeChunked(response.body);
+    }
+    return response;
+}
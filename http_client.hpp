@@ -0,0 +1,18 @@
+#pragma once
+
+#include <string>
+
+struct http_response {
+    int status;      // 0 if the request failed before a status line arrived
+    std::string body;
+};
+
+// Minimal blocking HTTP/1.1 client for the chainweb mining API. Plain HTTP
+// only; put a TLS terminator in front of nodes that only speak HTTPS.
+http_response http_request(
+    const std::string& address,   // host:port
+    const std::string& method,
+    const std::string& path,
+    const std::string& content_type,
+    const std::string& body,
+    int timeout_ms);
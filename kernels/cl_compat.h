@@ -0,0 +1,44 @@
+#pragma once
+
+// Just enough OpenCL C for kernel.cl to compile as C++ on the host, so that
+// the CPU backend runs the very same kernel source as the GPUs.
+//
+// Include this, define the build options (-D...) the kernel expects, then
+// include kernel.cl. Kernels run one work item per call; set
+// cl_compat::global_id before each call.
+
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+
+typedef unsigned int uint;
+
+#define kernel
+#define global
+#define constant const
+
+namespace cl_compat {
+    extern thread_local size_t global_id;
+};
+
+inline size_t get_global_id(uint) {
+    return cl_compat::global_id;
+}
+
+inline uint32_t rotate(uint32_t v, uint32_t n) {
+    return (v << n) | (v >> (32 - n));
+}
+
+using std::min;
+
+// Hits of -DNONCE32 kernels are kept in a select instead of a conditional
+// store, so that the compiler vectorizes the nonce loop across SIMD lanes.
+#define HIT_VARS uint32_t hit_lo = 0; int hit_any = 0;
+#define RECORD_HIT(hit, lo, hi) do { \
+    int hit_ = (hit);                \
+    hit_lo = hit_ ? (lo) : hit_lo;   \
+    hit_any |= hit_;                 \
+  } while (0)
+#define STORE_HITS(hi) do { \
+    if (hit_any) *result_ptr = (((uint64_t) (hi)) << 32) | hit_lo; \
+  } while (0)
@@ -203,7 +203,14 @@ typedef signed   char    int8_t;
 #define Mx(r0, r, i)    Mx_(r0, Z ## r ## i)
 #define Mx_(r0, n)      Mx__(r0, n)
 #define Mx__(r0, n)     Bx(r0, n)
-#define Bx(r, i) B ## r ## i
+#ifdef RUNTIME_HEADER
+  // Header words come from a kernel argument instead of -DBxx constants, so
+  // one build serves every job. Words 0 and 1 are the nonce.
+  #define Bx(r, i) HW(0x ## r ## i)
+  #define HW(n) ((n) == 0 ? B00 : (n) == 1 ? B01 : header[n])
+#else
+  #define Bx(r, i) B ## r ## i
+#endif
 
 #define G(m0, m1, a,b,c,d)       \
   do {                           \
@@ -218,7 +225,7 @@ typedef signed   char    int8_t;
   } while (0)
 
 
-#define ROUND(r0, r)                               \ 
+#define ROUND(r0, r)                               \
   do {                                             \
     G(Mx(r0, r, 0), Mx(r0, r, 1), V0, V4, V8, VC); \
     G(Mx(r0, r, 2), Mx(r0, r, 3), V1, V5, V9, VD); \
@@ -267,6 +274,75 @@ typedef signed   char    int8_t;
     H7 = H7 ^ V7 ^ VF;              \
   } while (0)
 
+#ifdef COMPACT_ROUNDS
+// Compact compression, built with -DCOMPACT_ROUNDS. The ten rounds run as a
+// loop that picks message words through the sigma table, so each block costs
+// one round body of code instead of ten. Whether the smaller footprint beats
+// the constant-indexed unrolled form depends on the device; chungus-bench -A
+// measures both.
+constant uint8_t SIGMA[10][16] = {
+  {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+  { 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 },
+  { 11,  8, 12,  0,  5,  2, 15, 13, 10, 14,  3,  6,  7,  1,  9,  4 },
+  {  7,  9,  3,  1, 13, 12, 11, 14,  2,  6,  5, 10,  4,  0, 15,  8 },
+  {  9,  0,  5,  7,  2,  4, 10, 15, 14,  1, 11, 12,  6,  8,  3, 13 },
+  {  2, 12,  6, 10,  0, 11,  8,  3,  4, 13,  7,  5, 15, 14,  1,  9 },
+  { 12,  5,  1, 15, 14, 13,  4, 10,  0,  7,  6,  3,  9,  2,  8, 11 },
+  { 13, 11,  7, 14, 12,  1,  3,  9,  5,  0, 15,  4,  8,  6,  2, 10 },
+  {  6, 15, 14,  9, 11,  3,  0,  8, 12,  2, 13,  7,  1,  4, 10,  5 },
+  { 10,  2,  8,  4,  7,  6,  1,  5, 15, 11,  9, 14,  3, 12, 13,  0 }
+};
+
+#define LOAD_MESSAGE(r) do {                                    \
+    M[0x0] = Bx(r, 0); M[0x1] = Bx(r, 1); M[0x2] = Bx(r, 2); M[0x3] = Bx(r, 3); \
+    M[0x4] = Bx(r, 4); M[0x5] = Bx(r, 5); M[0x6] = Bx(r, 6); M[0x7] = Bx(r, 7); \
+    M[0x8] = Bx(r, 8); M[0x9] = Bx(r, 9); M[0xA] = Bx(r, A); M[0xB] = Bx(r, B); \
+    M[0xC] = Bx(r, C); M[0xD] = Bx(r, D); M[0xE] = Bx(r, E); M[0xF] = Bx(r, F); \
+  } while (0)
+
+#define COMPRESS(r0, f0, t0) do {                     \
+    uint32_t M[16];                                   \
+    LOAD_MESSAGE(r0);                                 \
+    V0 = H0;                                          \
+    V1 = H1;                                          \
+    V2 = H2;                                          \
+    V3 = H3;                                          \
+    V4 = H4;                                          \
+    V5 = H5;                                          \
+    V6 = H6;                                          \
+    V7 = H7;                                          \
+    V8 = IV0;                                         \
+    V9 = IV1;                                         \
+    VA = IV2;                                         \
+    VB = IV3;                                         \
+    VC = t0 ^ IV4;                                    \
+    VD = IV5;                                         \
+    VE = f0 ^ IV6;                                    \
+    VF = IV7;                                         \
+    for (int round = 0; round < 10; round++) {        \
+      constant uint8_t* s = SIGMA[round];             \
+      G(M[s[0x0]], M[s[0x1]], V0, V4, V8, VC);        \
+      G(M[s[0x2]], M[s[0x3]], V1, V5, V9, VD);        \
+      G(M[s[0x4]], M[s[0x5]], V2, V6, VA, VE);        \
+      G(M[s[0x6]], M[s[0x7]], V3, V7, VB, VF);        \
+      G(M[s[0x8]], M[s[0x9]], V0, V5, VA, VF);        \
+      G(M[s[0xA]], M[s[0xB]], V1, V6, VB, VC);        \
+      G(M[s[0xC]], M[s[0xD]], V2, V7, V8, VD);        \
+      G(M[s[0xE]], M[s[0xF]], V3, V4, V9, VE);        \
+    }                                                 \
+    H0 = H0 ^ V0 ^ V8;                                \
+    H1 = H1 ^ V1 ^ V9;                                \
+    H2 = H2 ^ V2 ^ VA;                                \
+    H3 = H3 ^ V3 ^ VB;                                \
+    H4 = H4 ^ V4 ^ VC;                                \
+    H5 = H5 ^ V5 ^ VD;                                \
+    H6 = H6 ^ V6 ^ VE;                                \
+    H7 = H7 ^ V7 ^ VF;                                \
+  } while (0)
+#else
+  #define COMPRESS(r, f0, t0) DO_COMPRESS(r, f0, t0)
+#endif
+
 #ifdef COMPARE_ALL
   #define TEST_RESULT() (                           \
       A0 > A                                        \
@@ -278,8 +354,83 @@ typedef signed   char    int8_t;
   #define TEST_RESULT() (A0 > A)
 #endif
 
+// The same test on 32-bit words, for -DNONCE32: the target words T7..T0 are
+// compared against H7..H0 from the most significant one down. Bitwise rather
+// than short-circuit operators keep it free of branches.
+#ifdef COMPARE_ALL
+  #define TEST_RESULT32() (                                            \
+      (T7 > H7) | ((T7 == H7) & (                                      \
+      (T6 > H6) | ((T6 == H6) & (                                      \
+      (T5 > H5) | ((T5 == H5) & (                                      \
+      (T4 > H4) | ((T4 == H4) & (                                      \
+      (T3 > H3) | ((T3 == H3) & (                                      \
+      (T2 > H2) | ((T2 == H2) & (                                      \
+      (T1 > H1) | ((T1 == H1) & (T0 >= H0))))))))))))))                \
+    )
+#else
+  #define TEST_RESULT32() ((T7 > H7) | ((T7 == H7) & (T6 > H6)))
+#endif
+
+// How -DNONCE32 kernels record a hit. kernels/cl_compat.h replaces these on
+// the CPU with a select that lets the compiler vectorize the nonce loop.
+#ifndef RECORD_HIT
+  #define HIT_VARS
+  #define RECORD_HIT(hit, lo, hi) do { if (hit) *result_ptr = (((uint64_t) (hi)) << 32) | (lo); } while (0)
+  #define STORE_HITS(hi)
+#endif
+
+#ifndef BATCH_HASH
+
+// Built with -DNONCE_BUFFER for hosts that replay a recorded launch sequence
+// (cl_khr_command_buffer), whose arguments are fixed at recording. Such
+// launches pass a start_nonce of 0 and take theirs from nonces[0], which
+// step_nonce advances; other launches pass a null buffer.
+#ifdef NONCE_BUFFER
+  #define NONCE_ARG , global const uint64_t* nonces
+  #define LOAD_NONCE() if (nonces) start_nonce += nonces[0]
+
+kernel void step_nonce(global uint64_t* nonces, global uint64_t* result_ptr, uint64_t step) {
+  nonces[0] = nonces[1];
+  nonces[1] += step;
+  *result_ptr = 0;
+}
+#else
+  #define NONCE_ARG
+  #define LOAD_NONCE()
+#endif
 
-kernel void search_nonce(uint64_t start_nonce, global uint64_t* result_ptr) {
+#ifdef RUNTIME_HEADER
+kernel void search_nonce(
+  uint64_t start_nonce,
+  global uint64_t* result_ptr,
+  constant uint32_t* header,
+  uint64_t A0,
+  uint64_t B0,
+  uint64_t C0,
+  uint64_t D0
+  NONCE_ARG
+) {
+#else
+kernel void search_nonce(uint64_t start_nonce, global uint64_t* result_ptr NONCE_ARG) {
+#endif
+  LOAD_NONCE();
+#ifdef NONCE32
+  // 32-bit form, for devices that emulate 64-bit integer arithmetic. The
+  // host never lets a launch carry into the high nonce word, so it is fixed
+  // and only the low word is counted.
+  uint32_t nonce_hi = (uint32_t) (start_nonce >> 32);
+  uint32_t nonce_lo0 = (uint32_t) start_nonce + (uint32_t) get_global_id(0) * WORKSET_SIZE;
+
+  uint32_t T7 = (uint32_t) (A0 >> 32), T6 = (uint32_t) A0;
+  uint32_t T5 = (uint32_t) (B0 >> 32), T4 = (uint32_t) B0;
+  uint32_t T3 = (uint32_t) (C0 >> 32), T2 = (uint32_t) C0;
+  uint32_t T1 = (uint32_t) (D0 >> 32), T0 = (uint32_t) D0;
+  HIT_VARS
+
+  for (uint32_t i = 0; i < WORKSET_SIZE; i++) {
+    uint32_t B00 = nonce_lo0 + i;
+    uint32_t B01 = nonce_hi;
+#else
   size_t gid = get_global_id(0);
   uint64_t nonce0 = start_nonce + gid * WORKSET_SIZE;
 
@@ -287,6 +438,7 @@ kernel void search_nonce(uint64_t start_nonce, global uint64_t* result_ptr) {
     uint64_t nonce = nonce0 + i;
     uint32_t B00 = (uint32_t) (nonce & 0xFFFFFFFF);
     uint32_t B01 = (uint32_t) (nonce >> 32);
+#endif
 
     uint32_t H0, H1, H2, H3, H4, H5, H6, H7;
 
@@ -302,12 +454,15 @@ kernel void search_nonce(uint64_t start_nonce, global uint64_t* result_ptr) {
     uint32_t V0, V1, V2, V3, V4, V5, V6, V7;
     uint32_t V8, V9, VA, VB, VC, VD, VE, VF;
 
-    DO_COMPRESS(0, 0x00000000, 0x00000040);
-    DO_COMPRESS(1, 0x00000000, 0x00000080);
-    DO_COMPRESS(2, 0x00000000, 0x000000C0);
-    DO_COMPRESS(3, 0x00000000, 0x00000100);
-    DO_COMPRESS(4, 0xFFFFFFFF, 0x0000011E);
+    COMPRESS(0, 0x00000000, 0x00000040);
+    COMPRESS(1, 0x00000000, 0x00000080);
+    COMPRESS(2, 0x00000000, 0x000000C0);
+    COMPRESS(3, 0x00000000, 0x00000100);
+    COMPRESS(4, 0xFFFFFFFF, 0x0000011E);
 
+#ifdef NONCE32
+    RECORD_HIT(TEST_RESULT32(), B00, nonce_hi);
+#else
     uint64_t A = (((uint64_t) H7) << 32) | H6;
 
     #ifdef COMPARE_ALL
@@ -319,5 +474,78 @@ kernel void search_nonce(uint64_t start_nonce, global uint64_t* result_ptr) {
     if (TEST_RESULT()) {
       *result_ptr = nonce;
     }
+#endif
   }
+#ifdef NONCE32
+  STORE_HITS(nonce_hi);
+#endif
+}
+
+#else
+
+// Bulk hashing of arbitrary messages, built with -DBATCH_HASH.
+//
+// Message k occupies data[offsets[k] .. offsets[k + 1]) and its 32 byte
+// digest is written to digests[8 * k .. 8 * k + 8). Each block is loaded into
+// B00..B0F so that the unrolled rounds of DO_COMPRESS(0, ...) apply as is.
+
+#define LOAD_BYTE(o) ((uint32_t) ((o) < n ? msg[t + (o)] : 0))
+#define LOAD_WORD(w) (              \
+    LOAD_BYTE(4 * (w))              \
+    | LOAD_BYTE(4 * (w) + 1) << 8   \
+    | LOAD_BYTE(4 * (w) + 2) << 16  \
+    | LOAD_BYTE(4 * (w) + 3) << 24  \
+  )
+
+kernel void hash_batch(
+  global const uint8_t* data,
+  global const uint32_t* offsets,
+  uint32_t count,
+  global uint32_t* digests
+) {
+  size_t gid = get_global_id(0);
+  if (gid >= count) return;
+
+  global const uint8_t* msg = data + offsets[gid];
+  uint32_t len = offsets[gid + 1] - offsets[gid];
+
+  uint32_t H0, H1, H2, H3, H4, H5, H6, H7;
+
+  H0 = 0x6b08e647UL;
+  H1 = IV(1);
+  H2 = IV(2);
+  H3 = IV(3);
+  H4 = IV(4);
+  H5 = IV(5);
+  H6 = IV(6);
+  H7 = IV(7);
+
+  uint32_t V0, V1, V2, V3, V4, V5, V6, V7;
+  uint32_t V8, V9, VA, VB, VC, VD, VE, VF;
+
+  uint32_t t = 0;
+  do {
+    uint32_t n = min(len - t, (uint32_t) BLAKE2S_BLOCKBYTES);
+    uint32_t f = (len - t <= BLAKE2S_BLOCKBYTES) ? 0xFFFFFFFF : 0;
+
+    uint32_t B00 = LOAD_WORD(0x0), B01 = LOAD_WORD(0x1), B02 = LOAD_WORD(0x2), B03 = LOAD_WORD(0x3);
+    uint32_t B04 = LOAD_WORD(0x4), B05 = LOAD_WORD(0x5), B06 = LOAD_WORD(0x6), B07 = LOAD_WORD(0x7);
+    uint32_t B08 = LOAD_WORD(0x8), B09 = LOAD_WORD(0x9), B0A = LOAD_WORD(0xA), B0B = LOAD_WORD(0xB);
+    uint32_t B0C = LOAD_WORD(0xC), B0D = LOAD_WORD(0xD), B0E = LOAD_WORD(0xE), B0F = LOAD_WORD(0xF);
+
+    t += n;
+    DO_COMPRESS(0, f, t);
+  } while (t < len);
+
+  global uint32_t* out = digests + 8 * gid;
+  out[0] = H0;
+  out[1] = H1;
+  out[2] = H2;
+  out[3] = H3;
+  out[4] = H4;
+  out[5] = H5;
+  out[6] = H6;
+  out[7] = H7;
 }
+
+#endif
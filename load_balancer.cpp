@@ -0,0 +1,180 @@
+#include <algorithm>
+#include <cstdio>
+
+#include "load_balancer.hpp"
+
+namespace detail {
+    const double RATE_ALPHA = 0.3;
+    const double BASELINE_DECAY = 0.999;
+    const double THROTTLE_RATIO = 0.85;
+    const double RECOVER_RATIO = 0.95;
+    const size_t THROTTLE_LAUNCHES = 5;
+    const size_t WARMUP_LAUNCHES = 3;
+
+    // Launches are sized for this fraction of max_launch_ms, leaving room
+    // for jitter between launches.
+    const double CAP_HEADROOM = 0.8;
+
+    // Until a device has been timed, capped launches start this many work
+    // groups small.
+    const size_t CAP_START_GROUPS = 256;
+
+    size_t wholeWaves(size_t size, size_t wave) {
+        return wave == 0 || size < wave ? size : size / wave * wave;
+    }
+
+    // As opencl_backend::quantize_global_size: the nearest whole waves, at
+    // least one.
+    size_t nearestWaves(size_t size, size_t wave) {
+        return wave == 0 ? size : std::max(wave, (size + wave / 2) / wave * wave);
+    }
+};
+
+load_balancer::load_balancer(size_t device_count, size_t global_size, size_t local_size, bool quiet)
+    : devices(device_count), global_size(global_size), local_size(local_size),
+      max_launch_ms(0), duty_cycle(1), quiet(quiet) {
+    for (device_health& health : devices) {
+        health = device_health();
+        health.global_size = global_size;
+    }
+}
+
+size_t load_balancer::next_global_size(size_t device) {
+    std::lock_guard<std::mutex> lock(mutex);
+    device_health& health = devices[device];
+    health.launch_size = health.global_size;
+    if (max_launch_ms > 0) {
+        size_t cap = health.cap_size > 0 ? health.cap_size : local_size * detail::CAP_START_GROUPS;
+        health.launch_size = std::min(health.launch_size, cap);
+    }
+    health.launch_size = detail::wholeWaves(health.launch_size, health.wave_size);
+    return health.launch_size;
+}
+
+void load_balancer::set_wave_sizes(const std::vector<size_t>& waves) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (size_t d = 0; d < devices.size() && d < waves.size(); d++) {
+        device_health& health = devices[d];
+        health.wave_size = waves[d];
+        health.global_size = detail::nearestWaves(global_size, waves[d]);
+    }
+}
+
+void load_balancer::record(size_t device, uint64_t hashes, double ms, double gap_ms) {
+    std::lock_guard<std::mutex> lock(mutex);
+    device_health& health = devices[device];
+    if (ms <= 0) return;
+
+    health.hashes += hashes;
+    health.busy_ms += ms;
+    health.max_launch_ms = std::max(health.max_launch_ms, ms);
+    if (gap_ms >= 0) {
+        health.gap_ms += gap_ms;
+        health.max_gap_ms = std::max(health.max_gap_ms, gap_ms);
+        health.gaps += 1;
+    }
+
+    // Follow the cap from every launch, the first one included: a launch
+    // that overran shrinks the next one right away.
+    if (max_launch_ms > 0 && health.launch_size > 0) {
+        double items_per_ms = health.launch_size / ms;
+        size_t size = (size_t) (items_per_ms * max_launch_ms * detail::CAP_HEADROOM) / local_size * local_size;
+        health.cap_size = std::min(global_size, std::max(local_size, size));
+    }
+
+    double rate = hashes / ms;
+    health.samples += 1;
+    if (health.samples == 1) {
+        // The first launch includes lazy driver initialization.
+        return;
+    } else if (health.samples == 2) {
+        health.rate = rate;
+        health.launch_ms = ms;
+    } else {
+        health.rate += detail::RATE_ALPHA * (rate - health.rate);
+        health.launch_ms += detail::RATE_ALPHA * (ms - health.launch_ms);
+    }
+    if (health.samples <= detail::WARMUP_LAUNCHES) return;
+
+    // While throttled the baseline stays put, so that sustained throttling
+    // never becomes the new normal and reads as a recovery.
+    if (!health.throttled) {
+        health.baseline = std::max(health.baseline * detail::BASELINE_DECAY, health.rate);
+    }
+
+    if (health.rate < detail::THROTTLE_RATIO * health.baseline) {
+        health.slow_launches += 1;
+        if (!health.throttled && health.slow_launches >= detail::THROTTLE_LAUNCHES) {
+            health.throttled = true;
+            health.throttle_events += 1;
+            if (!quiet) fprintf(stderr, "Device %zu throttling: %.2f MH/s, baseline %.2f MH/s\n",
+                device, health.rate / 1e3, health.baseline / 1e3);
+        }
+    } else {
+        health.slow_launches = 0;
+        if (health.throttled && health.rate >= detail::RECOVER_RATIO * health.baseline) {
+            health.throttled = false;
+            if (!quiet) fprintf(stderr, "Device %zu recovered: %.2f MH/s\n", device, health.rate / 1e3);
+        }
+    }
+
+    // Only a throttled device is resized, to keep its launch duration.
+    size_t size = global_size;
+    if (health.throttled) {
+        size = (size_t) (global_size * std::min(1.0, health.rate / health.baseline)) / local_size * local_size;
+    }
+    health.global_size = detail::nearestWaves(std::max(local_size, size), health.wave_size);
+}
+
+void load_balancer::set_cotenant(double max_launch_ms, double duty_cycle) {
+    std::lock_guard<std::mutex> lock(mutex);
+    this->max_launch_ms = max_launch_ms;
+    this->duty_cycle = duty_cycle > 0 && duty_cycle < 1 ? duty_cycle : 1;
+}
+
+bool load_balancer::cotenant() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return max_launch_ms > 0 || duty_cycle < 1;
+}
+
+double load_balancer::idle_ms(double ms) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return ms * (1 - duty_cycle) / duty_cycle;
+}
+
+void load_balancer::print_cotenant_report() {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (size_t device = 0; device < devices.size(); device++) {
+        const device_health& health = devices[device];
+        double wall_ms = health.busy_ms + health.gap_ms;
+        if (wall_ms <= 0) continue;
+
+        // Measured against the best rate the device reached inside launches.
+        double achieved = health.hashes / wall_ms;
+        double given_up = health.baseline > 0 ? std::max(0.0, 1 - achieved / health.baseline) : 0;
+        size_t launches = health.samples;
+        fprintf(stderr,
+            "Device %zu co-tenant: launch avg %.1f ms max %.1f ms, gap avg %.1f ms max %.1f ms, "
+            "%.2f MH/s (%.1f%% given up)\n",
+            device, health.busy_ms / std::max<size_t>(launches, 1), health.max_launch_ms,
+            health.gap_ms / std::max<size_t>(health.gaps, 1), health.max_gap_ms,
+            achieved / 1e3, 100 * given_up);
+    }
+}
+
+uint64_t load_balancer::throttle_events() {
+    std::lock_guard<std::mutex> lock(mutex);
+    uint64_t events = 0;
+    for (const device_health& health : devices) events += health.throttle_events;
+    return events;
+}
+
+void load_balancer::record_error(size_t device) {
+    std::lock_guard<std::mutex> lock(mutex);
+    devices[device].errors += 1;
+}
+
+std::vector<device_health> load_balancer::snapshot() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return devices;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// Launch statistics of one device, in hashes per millisecond.
+struct device_health {
+    double rate;           // fast EWMA of the launch hashrate
+    double baseline;       // best sustained rate seen, decaying slowly, frozen while throttled
+    double launch_ms;      // fast EWMA of the launch duration
+    size_t samples;
+    size_t slow_launches;  // consecutive launches below THROTTLE_RATIO
+    bool throttled;
+    uint64_t throttle_events;
+    size_t global_size;
+    size_t launch_size;    // size handed out by the last next_global_size
+    size_t cap_size;       // largest size that fits max_launch_ms, 0 if unknown
+    size_t wave_size;      // launches of at least one wave are whole waves, 0 for any size
+    uint64_t errors;       // nonces the device reported that failed verification
+
+    // Co-tenant accounting: time on the device, time between launches.
+    uint64_t hashes;
+    double busy_ms;
+    double gap_ms;
+    double max_launch_ms;
+    double max_gap_ms;
+    size_t gaps;
+};
+
+// Sizes each device's launches from its measured hashrate.
+//
+// Devices search independently, with no rounds to wait for each other in, so
+// healthy devices keep the configured global size whatever the others do. A
+// device counts as throttled once its rate has stayed below THROTTLE_RATIO of
+// its own baseline for THROTTLE_LAUNCHES launches; until it recovers, its
+// launches shrink with its rate so that they take as long as they did before,
+// and it still notices a new block or a solution elsewhere as soon.
+//
+// In co-tenant mode, for devices shared with a display or other jobs, no
+// launch may take longer than max_launch_ms and each device only computes
+// for the duty_cycle fraction of the time. Both can change at any time.
+struct load_balancer {
+    std::vector<device_health> devices;
+    size_t global_size;
+    size_t local_size;
+    double max_launch_ms;  // 0 for no cap
+    double duty_cycle;     // 1 for no pauses
+    bool quiet;
+    std::mutex mutex;
+
+    load_balancer(size_t device_count, size_t global_size, size_t local_size, bool quiet);
+
+    // Global work size for the next launch on `device`.
+    size_t next_global_size(size_t device);
+
+    // Launch granularity of each device, see opencl_backend::wave_sizes. The
+    // configured global size is rounded to the nearest whole waves, and
+    // smaller sizes (throttling, capped launches) down to whole waves.
+    void set_wave_sizes(const std::vector<size_t>& waves);
+
+    // Records a finished launch of `hashes` nonces that took `ms`, started
+    // `gap_ms` after the previous launch on the device finished (< 0: first).
+    void record(size_t device, uint64_t hashes, double ms, double gap_ms = -1);
+
+    uint64_t throttle_events();
+
+    // Counts a nonce from `device` that failed verification on the host.
+    void record_error(size_t device);
+
+    // A consistent copy of every device's statistics, e.g. for a stats scrape.
+    std::vector<device_health> snapshot();
+
+    void set_cotenant(double max_launch_ms, double duty_cycle);
+    bool cotenant();
+
+    // Time to leave the device idle after a launch of `ms` to keep within
+    // the duty cycle.
+    double idle_ms(double ms);
+
+    // Per device: launch duration and the gaps in between, which is what
+    // the other tenants see, next to the hashrate given up for them.
+    void print_cotenant_report();
+};
@@ -0,0 +1,168 @@
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <inttypes.h>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "common.h"
+#include "load_balancer.hpp"
+#include "native_client.hpp"
+#include "opencl_backend.hpp"
+#include "search.hpp"
+#include "stats_server.hpp"
+#include "tuning_db.hpp"
+
+void usage() {
+  fprintf(
+    stderr,
+    "  chungus-native -N <node> [ -N <node> ... ]\n"
+    "                 -a <account> -K <public key>\n"
+    "                 [ -e <network>            ]\n"
+    "                 [ -i <poll interval ms>   ]\n"
+    "                 [ -d <device id(s)>       ]\n"
+    "                 [ -p <platform id>        ]\n"
+    "                 [ -l <local work size>    ]\n"
+    "                 [ -w <work set size>      ]\n"
+    "                 [ -g <global work size>   ]\n"
+    "                 [ -k <kernel location>    ]\n"
+    "                 [ -V <kernel variant>     ]\n"
+    "                 [ -c <max launch ms>      ]\n"
+    "                 [ -u <duty cycle %%>       ]\n"
+    "                 [ -M <[host:]port>        ]\n"
+    "                 [ -v                      ]\n\n"
+    "  Native client mode: talks to chainweb nodes directly instead of being run\n"
+    "  by chainweb-miner. Work is polled from every node at once, the freshest\n"
+    "  header across them is mined, and solutions are submitted to all nodes\n"
+    "  concurrently while mining goes on. Per-node work freshness and submission\n"
+    "  latency are printed once all nodes have answered a solution.\n\n"
+    "    -N <node>\n"
+    "      host:port of a node. Repeat for every node. Plain HTTP only.\n\n"
+    "    -e <network>\n"
+    "      Default `mainnet01`\n\n"
+    "    -i <poll interval ms>\n"
+    "      Default `1000`\n\n"
+    "    -M <[host:]port>\n"
+    "      Serves live device statistics at GET /stats for chungus-farm, as chungusd\n"
+    "      does. Bad nonces are counted there instead of stopping the miner.\n\n"
+    "  The remaining options are the same as for bigolchungus.\n\n"
+  );
+}
+
+int main(int argc, char* const* argv) {
+    std::vector<std::string> nodes;
+    std::string account;
+    std::string publicKey;
+    std::string network = "mainnet01";
+    int pollMs = 1000;
+    bool quiet = true;
+    std::vector<int> deviceOverrides(1, 0);
+    int platformOverride = -1;
+    size_t localWorkSize = 256;
+    size_t workSetSize = 64;
+    size_t globalSize = 1024 * 1024 * 16;
+    char* kernelPath = nullptr;
+    std::string variant = "unrolled";
+    double maxLaunchMs = 0;
+    double dutyCycle = 1;
+    std::string statsAddress;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "N:a:K:e:i:d:p:l:w:g:k:V:c:u:M:vh")) != -1) {
+      switch(opt) {
+        case 'N': nodes.push_back(optarg); break;
+        case 'a': account = optarg; break;
+        case 'K': publicKey = optarg; break;
+        case 'e': network = optarg; break;
+        case 'i': pollMs = std::stoi(optarg); break;
+        case 'd': deviceOverrides = parse_int_list(optarg); break;
+        case 'p': platformOverride = std::stoi(optarg); break;
+        case 'l': localWorkSize = std::stoi(optarg); break;
+        case 'w': workSetSize = std::stoi(optarg); break;
+        case 'g': globalSize = std::stoi(optarg); break;
+        case 'k': kernelPath = optarg; break;
+        case 'V': variant = optarg; break;
+        case 'c': maxLaunchMs = std::stod(optarg); break;
+        case 'u': dutyCycle = std::stod(optarg) / 100.0; break;
+        case 'M': statsAddress = optarg; break;
+        case 'v': quiet = false; break;
+        case 'h':
+        case '?':
+          usage();
+          exit(1);
+      }
+    }
+
+    if (nodes.empty() || account.empty() || publicKey.empty()) {
+      usage();
+      exit(1);
+    }
+
+    opencl_backend backend(0, quiet, deviceOverrides, platformOverride, kernelPath);
+    apply_tuning(backend.devices[0].build_key, quiet, variant, localWorkSize, workSetSize, globalSize);
+    if (!backend.set_kernel_variant(variant)) {
+        fprintf(stderr, "Unknown kernel variant %s\n", variant.c_str());
+        exit(1);
+    }
+    backend.prepare_search(globalSize, localWorkSize, workSetSize);
+    load_balancer balancer(backend.devices.size(), globalSize, localWorkSize, quiet);
+    balancer.set_wave_sizes(backend.wave_sizes());
+    balancer.set_cotenant(maxLaunchMs, dutyCycle);
+
+    if (!statsAddress.empty()) {
+        int stats = listen_stats(statsAddress);
+        if (stats < 0) {
+            fprintf(stderr, "Cannot serve stats on %s\n", statsAddress.c_str());
+            exit(1);
+        }
+        serve_stats(stats, [&]() {
+            std::string report;
+            append_device_stats(report, platformOverride, deviceOverrides, backend, balancer, workSetSize);
+            return report;
+        });
+    }
+
+    std::string minerJson =
+        "{\"account\":\"" + account + "\",\"predicate\":\"keys-all\","
+        "\"public-keys\":[\"" + publicKey + "\"]}";
+    node_set source(nodes, network, minerJson, pollMs, quiet);
+
+    FILE* urandom = fopen("/dev/urandom","rb");
+    while (true) {
+        mining_work work;
+        uint64_t generation = source.wait_for_work(work);
+
+        uint8_t buf[320] = {0};
+        memcpy(buf, work.header, WORK_HEADER_SIZE);
+        backend.set_search_job(buf, work.target);
+
+        search_job job;
+        job.block_data = buf;
+        job.block_size = WORK_HEADER_SIZE;
+        job.target_hash = work.target;
+        fread(&job.start_nonce, 1, 8, urandom);
+        job.workset_size = workSetSize;
+        job.coordinator = nullptr;
+        job.quiet = quiet;
+        job.cancelled = [&source, generation]() { return source.generation != generation; };
+        job.hash_share = 0;
+        job.tolerate_bad_nonces = true;
+
+        auto t_start = std::chrono::high_resolution_clock::now();
+        search_result result = run_search(backend, balancer, job);
+        if (!result.found) continue;
+        auto t_end = std::chrono::high_resolution_clock::now();
+        double seconds = std::chrono::duration<double>(t_end - t_start).count();
+
+        memcpy(work.header, &result.nonce, 8);
+        source.submit(work);
+        fprintf(stderr, "Solved chain %u with nonce %016" PRIx64 " (%.2f MH/s), submitting to %zu node(s)\n",
+            work.chain, result.nonce, result.hashes / seconds / 1e6, nodes.size());
+        if (balancer.cotenant()) balancer.print_cotenant_report();
+    }
+
+    return 0;
+}
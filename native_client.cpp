@@ -0,0 +1,183 @@
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <cinttypes>
+#include <iostream>
+#include <string>
+
+#include "http_client.hpp"
+#include "native_client.hpp"
+
+namespace detail {
+    const int REQUEST_TIMEOUT_MS = 10000;
+    const double STATS_ALPHA = 0.2;
+
+    double nowMs() {
+        return std::chrono::duration<double, std::milli>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    // Headers that differ only in their nonce are the same work.
+    bool sameWork(const uint8_t* a, const uint8_t* b) {
+        return memcmp(a + 8, b + 8, WORK_HEADER_SIZE - 8) == 0;
+    }
+
+    // Nodes hand out a new header with a new creation time on every request;
+    // only a new parent (bytes 16 .. 48) makes the work being mined stale.
+    bool sameParent(const uint8_t* a, const uint8_t* b) {
+        return memcmp(a + 16, b + 16, 32) == 0;
+    }
+
+    void updateAverage(double& average, double sample, uint64_t count) {
+        average = count <= 1 ? sample : average + STATS_ALPHA * (sample - average);
+    }
+};
+
+node_set::node_set(
+    const std::vector<std::string>& nodes, const std::string& network,
+    const std::string& miner_json, int poll_ms, bool quiet
+) : nodes(nodes), network(network), miner_json(miner_json), poll_ms(poll_ms), quiet(quiet),
+    stats(nodes.size()), has_work(false), generation(0), stopping(false), outboxes(nodes.size()) {
+    memset(solved_header, 0, sizeof(solved_header));
+    for (size_t i = 0; i < nodes.size(); i++) {
+        stats[i] = node_stats();
+        stats[i].address = nodes[i];
+        pollers.push_back(std::thread(&node_set::poll, this, i));
+        submitters.push_back(std::thread(&node_set::post, this, i));
+    }
+}
+
+node_set::~node_set() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    changed.notify_all();
+    submitted.notify_all();
+    for (std::thread& poller : pollers) poller.join();
+    for (std::thread& submitter : submitters) submitter.join();
+}
+
+bool node_set::fetch(size_t node, mining_work& work) {
+    double t_start = detail::nowMs();
+    http_response response = http_request(
+        nodes[node], "POST", "/chainweb/0.0/" + network + "/mining/work",
+        "application/json", miner_json, detail::REQUEST_TIMEOUT_MS);
+    double t_end = detail::nowMs();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    node_stats& s = stats[node];
+    s.last_fetch_ms = t_end - t_start;
+    if (response.status != 200 || response.body.size() != 4 + 32 + WORK_HEADER_SIZE) {
+        s.fetch_errors += 1;
+        if (!quiet) std::cerr << nodes[node] << ": work request failed with status " << response.status << std::endl;
+        return false;
+    }
+
+    const uint8_t* body = reinterpret_cast<const uint8_t*>(response.body.data());
+    memcpy(&work.chain, body, 4);
+    memcpy(work.target, body + 4, 32);
+    memcpy(work.header, body + 36, WORK_HEADER_SIZE);
+    memcpy(&work.creation_time, work.header + 8, 8);
+    work.node = node;
+
+    s.work_fetched += 1;
+    detail::updateAverage(s.avg_age_ms, t_end - work.creation_time / 1000.0, s.work_fetched);
+    return true;
+}
+
+void node_set::poll(size_t node) {
+    while (!stopping) {
+        mining_work work;
+        if (fetch(node, work)) {
+            std::lock_guard<std::mutex> lock(mutex);
+            bool fresher = !has_work
+                || (work.creation_time > current.creation_time
+                    && !detail::sameParent(work.header, current.header));
+            bool solved = detail::sameParent(work.header, solved_header);
+            if (fresher && !solved) {
+                if (!quiet) std::cerr << nodes[node] << ": fresher work on chain " << work.chain << std::endl;
+                current = work;
+                has_work = true;
+                stats[node].freshest_wins += 1;
+                generation += 1;
+                changed.notify_all();
+            }
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait_for(lock, std::chrono::milliseconds(poll_ms), [this]() { return stopping.load(); });
+    }
+}
+
+uint64_t node_set::wait_for_work(mining_work& work) {
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [this]() {
+        return has_work && !detail::sameParent(current.header, solved_header);
+    });
+    work = current;
+    return generation;
+}
+
+void node_set::submit(const mining_work& work) {
+    std::shared_ptr<solution_submission> submission = std::make_shared<solution_submission>();
+    submission->chain = work.chain;
+    memcpy(&submission->nonce, work.header, 8);
+    submission->header.assign(reinterpret_cast<const char*>(work.header), WORK_HEADER_SIZE);
+    submission->remaining = nodes.size();
+    submission->accepted = 0;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        memcpy(solved_header, work.header, WORK_HEADER_SIZE);
+        for (std::deque<std::shared_ptr<solution_submission> >& outbox : outboxes) outbox.push_back(submission);
+    }
+    submitted.notify_all();
+}
+
+void node_set::post(size_t node) {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        submitted.wait(lock, [this, node]() { return stopping || !outboxes[node].empty(); });
+        if (stopping) return;
+        std::shared_ptr<solution_submission> submission = outboxes[node].front();
+        outboxes[node].pop_front();
+        lock.unlock();
+
+        double t_start = detail::nowMs();
+        http_response response = http_request(
+            nodes[node], "POST", "/chainweb/0.0/" + network + "/mining/solved",
+            "application/octet-stream", submission->header, detail::REQUEST_TIMEOUT_MS);
+        double elapsed = detail::nowMs() - t_start;
+
+        lock.lock();
+        node_stats& s = stats[node];
+        s.submissions += 1;
+        s.last_submit_ms = elapsed;
+        detail::updateAverage(s.avg_submit_ms, elapsed, s.submissions);
+        if (response.status / 100 == 2) {
+            s.accepted += 1;
+            submission->accepted += 1;
+        } else if (!quiet) {
+            std::cerr << nodes[node] << ": solution rejected with status " << response.status << std::endl;
+        }
+        if (--submission->remaining == 0) {
+            fprintf(stderr, "Solution %016" PRIx64 " for chain %u accepted by %zu/%zu node(s)\n",
+                submission->nonce, submission->chain, submission->accepted, nodes.size());
+            lock.unlock();
+            print_stats();
+            lock.lock();
+        }
+    }
+}
+
+void node_set::print_stats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    fprintf(stderr, "%-28s %7s %7s %9s %9s %7s %9s %9s\n",
+        "node", "work", "errors", "fetch ms", "age ms", "fresh", "submits", "submit ms");
+    for (const node_stats& s : stats) {
+        fprintf(stderr, "%-28s %7lu %7lu %9.1f %9.1f %7lu %4lu/%-4lu %9.1f\n",
+            s.address.c_str(), s.work_fetched, s.fetch_errors, s.last_fetch_ms, s.avg_age_ms,
+            s.freshest_wins, s.accepted, s.submissions, s.avg_submit_ms);
+    }
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+const size_t WORK_HEADER_SIZE = 286;
+
+// One unit of work as served by /mining/work: chain id, target and header.
+struct mining_work {
+    uint32_t chain;
+    uint8_t target[32];
+    uint8_t header[WORK_HEADER_SIZE];
+    uint64_t creation_time;   // microseconds since the epoch, from the header
+    size_t node;              // index of the node that served it
+};
+
+struct node_stats {
+    std::string address;
+    uint64_t work_fetched;
+    uint64_t fetch_errors;
+    double last_fetch_ms;
+    double avg_age_ms;        // work age (now - creation time) when fetched
+    uint64_t freshest_wins;   // times this node served the work being mined
+    uint64_t submissions;
+    uint64_t accepted;
+    double last_submit_ms;
+    double avg_submit_ms;
+};
+
+// A solved header on its way to the nodes.
+struct solution_submission {
+    uint32_t chain;
+    uint64_t nonce;
+    std::string header;
+    size_t remaining;         // nodes that have not answered yet
+    size_t accepted;
+};
+
+// Sources work from several chainweb nodes at once and fans solutions out to
+// all of them.
+//
+// Every node is polled from its own thread, and solutions are posted to it
+// from another, so that a slow or dead node delays neither the others nor
+// the search for the next block. Work on a new parent that is
+// fresher, by creation time, than the work being mined replaces it, whichever
+// node it comes from; each replacement bumps the generation counter so that
+// a running search can bail out.
+struct node_set {
+    std::vector<std::string> nodes;
+    std::string network;
+    std::string miner_json;
+    int poll_ms;
+    bool quiet;
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::vector<node_stats> stats;
+    mining_work current;
+    bool has_work;
+    uint8_t solved_header[WORK_HEADER_SIZE];
+    std::atomic<uint64_t> generation;
+    std::atomic<bool> stopping;
+    std::vector<std::thread> pollers;
+    std::vector<std::deque<std::shared_ptr<solution_submission> > > outboxes;
+    std::condition_variable submitted;
+    std::vector<std::thread> submitters;
+
+    node_set(
+        const std::vector<std::string>& nodes, const std::string& network,
+        const std::string& miner_json, int poll_ms, bool quiet);
+    ~node_set();
+
+    // Blocks until there is unsolved work; returns it and its generation.
+    uint64_t wait_for_work(mining_work& work);
+
+    // Queues a solved header for every node and returns at once. The outcome
+    // is logged, with the node statistics, once all nodes have answered.
+    void submit(const mining_work& work);
+
+    void print_stats();
+
+private:
+    void poll(size_t node);
+    void post(size_t node);
+    bool fetch(size_t node, mining_work& work);
+};
@@ -0,0 +1,243 @@
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "blake2s_ref.h"
+#include "nonce_coordinator.hpp"
+
+namespace detail {
+    const uint32_t SEGMENT_MAGIC = 0x43687567; // "Chug"
+    const char* SEGMENT_PREFIX = "bigolchungus-";
+
+    // Segments of jobs that were superseded by a new block are never solved
+    // and therefore never unlinked by a solver. Sweep them once no process
+    // has claimed nonces from them for this long.
+    const time_t STALE_SEGMENT_SECONDS = 10 * 60;
+
+    std::string segmentName(const uint8_t* target_hash, const uint8_t* block_data, size_t block_size) {
+        uint8_t job[32];
+        blake2s_state state;
+        blake2s_init(&state, sizeof(job));
+        blake2s_update(&state, target_hash, 32);
+        // The first 8 bytes are the nonce and not part of the job identity.
+        blake2s_update(&state, block_data + 8, block_size - 8);
+        blake2s_final(&state, job, sizeof(job));
+
+        char hex[17];
+        for (int i = 0; i < 8; i++) snprintf(hex + 2 * i, 3, "%02x", job[i]);
+        return std::string("/") + SEGMENT_PREFIX + hex;
+    }
+
+    // Writes through the mapping need not update the file's mtime (tmpfs
+    // does not), so initialized segments are judged by their heartbeat. Only
+    // a segment that was never sized falls back to its mtime.
+    bool staleSegment(const std::string& name, time_t now) {
+        int fd = shm_open(name.c_str(), O_RDONLY, 0);
+        if (fd < 0) return false;
+        bool stale = false;
+        struct stat st;
+        if (fstat(fd, &st) == 0) {
+            if (st.st_size < (off_t) sizeof(nonce_segment)) {
+                stale = now - st.st_mtime > STALE_SEGMENT_SECONDS;
+            } else {
+                void* mem = mmap(nullptr, sizeof(nonce_segment), PROT_READ, MAP_SHARED, fd, 0);
+                if (mem != MAP_FAILED) {
+                    const nonce_segment* segment = static_cast<const nonce_segment*>(mem);
+                    stale = segment->magic.load(std::memory_order_acquire) == SEGMENT_MAGIC
+                        && now - segment->heartbeat.load(std::memory_order_relaxed) > STALE_SEGMENT_SECONDS;
+                    munmap(mem, sizeof(nonce_segment));
+                }
+            }
+        }
+        close(fd);
+        return stale;
+    }
+
+    void sweepStaleSegments(bool quiet) {
+        DIR* dir = opendir("/dev/shm");
+        if (dir == nullptr) return;
+
+        time_t now = time(nullptr);
+        struct dirent* entry;
+        while ((entry = readdir(dir)) != nullptr) {
+            if (strncmp(entry->d_name, SEGMENT_PREFIX, strlen(SEGMENT_PREFIX)) != 0) continue;
+            std::string name = std::string("/") + entry->d_name;
+            if (staleSegment(name, now)) {
+                if (!quiet) std::cerr << "Removing stale nonce segment " << entry->d_name << std::endl;
+                shm_unlink(name.c_str());
+            }
+        }
+        closedir(dir);
+    }
+
+    // Whether the claims of `owner` may be handed out again.
+    bool ownerGone(uint32_t owner) {
+        return owner == NONCE_ABANDONED || (kill(owner, 0) != 0 && errno == ESRCH);
+    }
+
+    // Takes a free entry of the claim table for `self`, nullptr when full.
+    nonce_claim* reserveClaim(nonce_segment* segment, uint32_t self) {
+        for (nonce_claim& claim : segment->claims) {
+            uint32_t expected = 0;
+            if (claim.owner.load(std::memory_order_relaxed) == 0
+                && claim.owner.compare_exchange_strong(expected, self)) {
+                return &claim;
+            }
+        }
+        return nullptr;
+    }
+
+    void fail(const char* what) {
+        std::cerr << what << " failed: " << strerror(errno) << std::endl;
+        std::exit(1);
+    }
+};
+
+nonce_coordinator::nonce_coordinator(
+    const uint8_t* target_hash,
+    const uint8_t* block_data, size_t block_size,
+    uint64_t start_nonce, bool quiet
+) : quiet(quiet) {
+    name = detail::segmentName(target_hash, block_data, block_size);
+
+    bool created = true;
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0 && errno == EEXIST) {
+        created = false;
+        fd = shm_open(name.c_str(), O_RDWR, 0600);
+    }
+    if (fd < 0) detail::fail("shm_open");
+
+    if (created) {
+        detail::sweepStaleSegments(quiet);
+        if (ftruncate(fd, sizeof(nonce_segment)) != 0) detail::fail("ftruncate");
+    } else {
+        // The creator may not have sized the segment yet.
+        struct stat st;
+        for (int i = 0; fstat(fd, &st) == 0 && st.st_size < (off_t) sizeof(nonce_segment); i++) {
+            if (i == 1000) {
+                std::cerr << "Nonce segment " << name << " was never initialized" << std::endl;
+                std::exit(1);
+            }
+            usleep(1000);
+        }
+    }
+
+    void* mem = mmap(nullptr, sizeof(nonce_segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mem == MAP_FAILED) detail::fail("mmap");
+    close(fd);
+    segment = static_cast<nonce_segment*>(mem);
+
+    if (created) {
+        // ftruncate zero-fills, so every atomic already reads as 0.
+        segment->base = start_nonce;
+        segment->heartbeat.store(time(nullptr), std::memory_order_relaxed);
+        segment->magic.store(detail::SEGMENT_MAGIC, std::memory_order_release);
+    } else {
+        for (int i = 0; segment->magic.load(std::memory_order_acquire) != detail::SEGMENT_MAGIC; i++) {
+            if (i == 1000) {
+                std::cerr << "Nonce segment " << name << " was never initialized" << std::endl;
+                std::exit(1);
+            }
+            usleep(1000);
+        }
+    }
+
+    uint32_t peers = segment->attached.fetch_add(1) + 1;
+    if (!quiet) {
+        std::cerr << (created ? "Created" : "Joined") << " nonce segment " << name
+                  << " (" << peers << " process(es), "
+                  << segment->cursor.load() << " nonces already claimed)" << std::endl;
+    }
+}
+
+nonce_coordinator::~nonce_coordinator() {
+    // Claims still held were not searched to the end; leave them to others.
+    uint32_t self = getpid();
+    for (nonce_claim& claim : segment->claims) {
+        if (claim.owner.load() != self) continue;
+        claim.owner.store(claim.count.load() != 0 ? NONCE_ABANDONED : 0);
+    }
+    segment->attached.fetch_sub(1);
+    munmap(segment, sizeof(nonce_segment));
+}
+
+uint64_t nonce_coordinator::claim(uint64_t count) {
+    uint32_t self = getpid();
+    segment->heartbeat.store(time(nullptr), std::memory_order_relaxed);
+
+    for (nonce_claim& claim : segment->claims) {
+        uint32_t owner = claim.owner.load();
+        if (owner == 0 || owner == self || !detail::ownerGone(owner)) continue;
+        if (!claim.owner.compare_exchange_strong(owner, self)) continue;
+
+        uint64_t first = claim.first.load();
+        uint64_t left = claim.count.load();
+        if (left == 0) {
+            // Its owner died before recording the range.
+            claim.owner.store(0);
+            continue;
+        }
+        if (left > count) {
+            // Take the head and leave the rest for the next claim.
+            nonce_claim* head = detail::reserveClaim(segment, self);
+            if (head != nullptr) {
+                head->first.store(first);
+                head->count.store(count);
+            }
+            claim.first.store(first + count);
+            claim.count.store(left - count);
+            claim.owner.store(NONCE_ABANDONED);
+        }
+        if (!quiet) {
+            std::cerr << "Resuming " << std::min(left, count) << " nonces abandoned by "
+                      << (owner == NONCE_ABANDONED ? std::string("a dead process") : "process " + std::to_string(owner))
+                      << std::endl;
+        }
+        return segment->base + first;
+    }
+
+    nonce_claim* claim = detail::reserveClaim(segment, self);
+    uint64_t first = segment->cursor.fetch_add(count);
+    if (claim != nullptr) {
+        claim->first.store(first);
+        claim->count.store(count);
+    }
+    return segment->base + first;
+}
+
+void nonce_coordinator::complete(uint64_t nonce, uint64_t count) {
+    uint32_t self = getpid();
+    uint64_t first = nonce - segment->base;
+    for (nonce_claim& claim : segment->claims) {
+        if (claim.owner.load() == self && claim.count.load() != 0 && claim.first.load() == first) {
+            claim.count.store(0);
+            claim.owner.store(0);
+            break;
+        }
+    }
+    segment->hashed.fetch_add(count, std::memory_order_relaxed);
+}
+
+void nonce_coordinator::publish(uint64_t nonce) {
+    segment->solution.store(nonce, std::memory_order_relaxed);
+    segment->solved.store(1, std::memory_order_release);
+    // The job is done; later processes for it should not resume its cursor.
+    shm_unlink(name.c_str());
+}
+
+bool nonce_coordinator::solved(uint64_t* nonce) const {
+    if (segment->solved.load(std::memory_order_acquire) == 0) return false;
+    *nonce = segment->solution.load(std::memory_order_relaxed);
+    return true;
+}
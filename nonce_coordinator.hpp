@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+// A claimed nonce range, recorded until it has been searched. `owner` is
+// the pid of the claiming process, 0 for a free entry and NONCE_ABANDONED for
+// the rest of a range whose owner died after a part of it was handed out
+// again. Offsets are relative to the segment's `base`.
+const uint32_t NONCE_ABANDONED = 0xffffffff;
+const size_t NONCE_CLAIMS = 256;
+
+struct nonce_claim {
+    std::atomic<uint32_t> owner;
+    std::atomic<uint64_t> first;
+    std::atomic<uint64_t> count;      // 0 until `first` is set
+};
+
+// Layout of the /dev/shm segment shared by every miner process working on
+// the same job. All offsets are relative to `base`, which the process that
+// creates the segment picks (random, or the -n override).
+struct nonce_segment {
+    std::atomic<uint32_t> magic;
+    std::atomic<uint32_t> attached;
+    uint64_t base;
+    std::atomic<uint64_t> cursor;     // next unclaimed offset
+    std::atomic<uint64_t> hashed;     // nonces fully searched by all processes
+    std::atomic<uint64_t> solution;
+    std::atomic<uint32_t> solved;
+    std::atomic<int64_t> heartbeat;   // time() of the last claim, for the sweep
+    nonce_claim claims[NONCE_CLAIMS];
+};
+
+// Hands out disjoint nonce blocks to independent processes on the same host.
+//
+// The segment is keyed by a hash of the job (target + header without the
+// nonce), so one-process-per-GPU setups searching the same work cooperate
+// like a single multi-device process, and a restarted process resumes at the
+// shared cursor instead of re-hashing ranges that were already claimed.
+//
+// Claims stay recorded until complete(), so the ranges of a process killed
+// mid-launch are handed out again once it is gone. Claims beyond
+// NONCE_CLAIMS outstanding at once, and those of a process killed between
+// taking the cursor and recording it, are not tracked and are lost with
+// their process.
+struct nonce_coordinator {
+    std::string name;
+    nonce_segment* segment;
+    bool quiet;
+
+    nonce_coordinator(
+        const uint8_t* target_hash,
+        const uint8_t* block_data, size_t block_size,
+        uint64_t start_nonce, bool quiet);
+    ~nonce_coordinator();
+
+    // Claims `count` nonces and returns the first one: the head of a range
+    // abandoned by a dead process if there is one, fresh nonces otherwise.
+    // An abandoned range may be shorter than `count`; searching past its end
+    // only repeats work.
+    uint64_t claim(uint64_t count);
+
+    // Records that the `count` nonces claimed at `nonce` have been searched.
+    void complete(uint64_t nonce, uint64_t count);
+
+    // Publishes a verified solution; other processes pick it up via solved().
+    void publish(uint64_t nonce);
+    bool solved(uint64_t* nonce) const;
+};
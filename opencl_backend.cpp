@@ -4,9 +4,22 @@
 #include <sstream>
 #include <strstream>
 #include <fstream>
+#include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
 
+#include "device_cache.hpp"
 #include "opencl_backend.hpp"
+#include "perf_stats.hpp"
+
+// NVIDIA device queries, from cl_ext.h.
+#define CL_DEVICE_COMPUTE_CAPABILITY_MAJOR_NV 0x4000
+#define CL_DEVICE_COMPUTE_CAPABILITY_MINOR_NV 0x4001
 
 namespace detail {
     std::string getPlatformName(cl_platform_id id) {
@@ -21,6 +34,19 @@ namespace detail {
         return result;
     }
 
+    std::string getPlatformString(cl_platform_id id, cl_platform_info param) {
+        size_t size = 0;
+        clGetPlatformInfo (id, param, 0, nullptr, &size);
+
+        std::string result;
+        result.resize (size);
+        clGetPlatformInfo (id, param, size,
+            const_cast<char*> (result.data ()), nullptr);
+
+        if (!result.empty() && result.back() == '\0') result.pop_back();
+        return result;
+    }
+
     std::string getDeviceName(cl_device_id id) {
         size_t size = 0;
         clGetDeviceInfo (id, CL_DEVICE_NAME, 0, nullptr, &size);
@@ -60,7 +86,9 @@ namespace detail {
         return program;
     }
 
-    cl_platform_id choosePlatform(bool quiet, int platform_override) {
+    // With `expected` from the device cache the platform is the one with that
+    // fingerprint, wherever it sits in the list; nullptr if none has it.
+    cl_platform_id choosePlatform(bool quiet, int platform_override, const platform_fingerprint* expected) {
         cl_uint platformIdCount = 0;
         clGetPlatformIDs (0, nullptr, &platformIdCount);
 
@@ -78,6 +106,17 @@ namespace detail {
             if (!quiet) std::cerr << "\t (" << i << ") : " << detail::getPlatformName(platformIds[i]) << std::endl;
         }
 
+        if (expected) {
+            for (cl_platform_id id : platformIds) {
+                platform_fingerprint found;
+                found.name = getPlatformString(id, CL_PLATFORM_NAME);
+                found.vendor = getPlatformString(id, CL_PLATFORM_VENDOR);
+                found.version = getPlatformString(id, CL_PLATFORM_VERSION);
+                if (found.matches(*expected)) return id;
+            }
+            return nullptr;
+        }
+
         if (platform_override == -1) {
           if (platformIdCount > 1) {
               if (!quiet) std::cerr << "Multiple platforms found. Using the first platform." << std::endl;
@@ -88,8 +127,61 @@ namespace detail {
         }
     }
 
-    std::pair<cl_device_id, cl_context> chooseDeviceAndCreateContext(
-        cl_platform_id platform_id, bool quiet, int device_override 
+    // Fingerprints every platform for the device cache. This enumerates the
+    // devices of all of them, so it only runs when there is no cache yet.
+    void storeDeviceCache(const std::string& path, bool quiet) {
+        cl_uint platformIdCount = 0;
+        clGetPlatformIDs (0, nullptr, &platformIdCount);
+        std::vector<cl_platform_id> platformIds (platformIdCount);
+        clGetPlatformIDs (platformIdCount, platformIds.data (), nullptr);
+
+        std::vector<platform_fingerprint> platforms;
+        for (cl_platform_id id : platformIds) platforms.push_back(fingerprint_platform(id));
+        if (!store_device_cache(path, platforms)) {
+            std::cerr << "Could not write the device cache " << path << std::endl;
+        } else if (!quiet) {
+            std::cerr << "Stored " << platforms.size() << " platform(s) in " << path << std::endl;
+        }
+    }
+
+    std::string getDeviceString(cl_device_id id, cl_device_info param) {
+        size_t size = 0;
+        clGetDeviceInfo (id, param, 0, nullptr, &size);
+
+        std::string result;
+        result.resize (size);
+        clGetDeviceInfo (id, param, size,
+            const_cast<char*> (result.data ()), nullptr);
+
+        // Drop the terminating NUL so the value can be concatenated.
+        if (!result.empty() && result.back() == '\0') result.pop_back();
+        return result;
+    }
+
+    // Devices are interchangeable for compilation when they are the same
+    // model driven by the same driver and OpenCL C compiler.
+    std::string getBuildKey(cl_device_id id) {
+        return getDeviceString(id, CL_DEVICE_NAME) + "|"
+            + getDeviceString(id, CL_DRIVER_VERSION) + "|"
+            + getDeviceString(id, CL_DEVICE_VERSION);
+    }
+
+    // A device may be listed several times to drive it from several host
+    // threads; the context and programs only want to see it once.
+    std::vector<cl_device_id> uniqueDevices(const std::vector<cl_device_id>& devices) {
+        std::vector<cl_device_id> unique;
+        for (cl_device_id device : devices) {
+            if (std::find(unique.begin(), unique.end(), device) == unique.end()) unique.push_back(device);
+        }
+        return unique;
+    }
+
+    // With `expected` from the device cache the overrides index its device
+    // list, and each is found by fingerprint rather than by position. Returns
+    // an empty list if one of them is gone.
+    std::vector<cl_device_id> chooseDevices(
+        cl_platform_id platform_id, bool quiet, const std::vector<int>& device_overrides,
+        const platform_fingerprint* expected
     ) {
         cl_uint deviceIdCount = 0;
         clGetDeviceIDs(platform_id, CL_DEVICE_TYPE_ALL, 0, nullptr, &deviceIdCount);
@@ -104,62 +196,428 @@ namespace detail {
         std::vector<cl_device_id> deviceIds (deviceIdCount);
         clGetDeviceIDs(platform_id, CL_DEVICE_TYPE_ALL, deviceIdCount, deviceIds.data(), nullptr);
 
-        int selectedDeviceId = -1;
-        if (device_override < 0) {
+        std::vector<int> selectedDeviceIds = device_overrides;
+        if (selectedDeviceIds.empty() || selectedDeviceIds[0] < 0) {
             for (cl_uint i = 0; i < deviceIdCount; ++i) {
                 std::cerr << "\t (" << i << ") : " << detail::getDeviceName(deviceIds[i]) << std::endl;
             }
 
+            int selectedDeviceId = -1;
             std::cerr << "Select one: ";
             std::cin >> selectedDeviceId;
-        } else {
-            selectedDeviceId = device_override;
+            selectedDeviceIds.assign(1, selectedDeviceId);
+            expected = nullptr;
+        }
+
+        std::vector<device_fingerprint> found;
+        if (expected) {
+            for (cl_device_id id : deviceIds) found.push_back(fingerprint_device(id));
         }
 
-        assert(0 <= selectedDeviceId && selectedDeviceId < deviceIdCount);
-        cl_device_id device_id = deviceIds[selectedDeviceId];
+        std::vector<cl_device_id> devices;
+        for (int selectedDeviceId : selectedDeviceIds) {
+            if (!expected) {
+                assert(0 <= selectedDeviceId && selectedDeviceId < deviceIdCount);
+                devices.push_back(deviceIds[selectedDeviceId]);
+                continue;
+            }
+            if (selectedDeviceId < 0 || selectedDeviceId >= (int) expected->devices.size()) {
+                return std::vector<cl_device_id>();
+            }
+            // Identical devices without a bus id keep their enumeration order.
+            const device_fingerprint& want = expected->devices[selectedDeviceId];
+            int ordinal = 0;
+            for (int j = 0; j < selectedDeviceId; j++) {
+                if (expected->devices[j].matches(want)) ordinal++;
+            }
+            size_t i = 0;
+            for (; i < found.size(); i++) {
+                if (found[i].matches(want) && ordinal-- == 0) break;
+            }
+            if (i == found.size()) return std::vector<cl_device_id>();
+            devices.push_back(deviceIds[i]);
+        }
+        return devices;
+    }
 
+    cl_context createContext(cl_platform_id platform_id, bool quiet, const std::vector<cl_device_id>& devices) {
         const cl_context_properties contextProperties [] = {
             CL_CONTEXT_PLATFORM, reinterpret_cast<cl_context_properties>(platform_id),
             0, 0
         };
 
         if (!quiet) std::cerr << "Creating context" << std::endl;
+        std::vector<cl_device_id> contextDevices = uniqueDevices(devices);
         cl_int error = CL_SUCCESS;
         cl_context context = clCreateContext(
             contextProperties,
-            1, &device_id,
+            contextDevices.size(), contextDevices.data(),
             nullptr, nullptr, &error);
         detail::checkError(error);
 
-        return std::make_pair(device_id, context);
+        return context;
+    }
+
+    // A cache that no longer describes the host: with loading restricted to
+    // its ICD there is no way back to the full list in this process, so start
+    // it over, with the same arguments and unrestricted loading.
+    void dropStaleDeviceCache(const std::string& path) {
+        std::cerr << "The device cache " << path << " does not match the installed OpenCL platforms"
+            << " or devices; removed it, restarting" << std::endl;
+        remove(path.c_str());
+        unsetenv("OCL_ICD_VENDORS");
+
+        std::ifstream cmdline("/proc/self/cmdline");
+        std::vector<std::string> args;
+        std::string arg;
+        while (std::getline(cmdline, arg, '\0')) args.push_back(arg);
+        std::vector<char*> argv;
+        for (std::string& a : args) argv.push_back(const_cast<char*>(a.c_str()));
+        argv.push_back(nullptr);
+        if (!args.empty()) execv("/proc/self/exe", argv.data());
+        std::cerr << "Cannot restart: " << strerror(errno) << ", run again" << std::endl;
+        exit(1);
+    }
+
+    void printBuildLog(cl_program program, cl_device_id device_id) {
+        size_t len = 0;
+        clGetProgramBuildInfo(program, device_id, CL_PROGRAM_BUILD_LOG, 0, NULL, &len);
+        char *log = new char[len];
+        clGetProgramBuildInfo(program, device_id, CL_PROGRAM_BUILD_LOG, len, log, NULL);
+        std::cerr << "\n\nBuildlog:\n" << log << "\n\n";
+        delete [] log;
+    }
+
+    cl_program buildProgram(
+        cl_context context, const std::string& source, const std::string& options,
+        const std::vector<cl_device_id>& devices
+    ) {
+        cl_program program = createProgram(source, context);
+        cl_int ret = clBuildProgram(
+            program, devices.size(), devices.data(),
+            options.data(), nullptr, nullptr);
+
+        if (ret != 0) {
+            printBuildLog(program, devices[0]);
+            detail::checkError (ret);
+        }
+        return program;
+    }
+
+    // The binary of `program` for `device`, empty if the runtime has none.
+    std::vector<unsigned char> getProgramBinary(cl_program program, cl_device_id device) {
+        cl_uint numDevices = 0;
+        detail::checkError(clGetProgramInfo(
+            program, CL_PROGRAM_NUM_DEVICES, sizeof(numDevices), &numDevices, nullptr));
+        std::vector<cl_device_id> programDevices(numDevices);
+        detail::checkError(clGetProgramInfo(
+            program, CL_PROGRAM_DEVICES, numDevices * sizeof(cl_device_id), programDevices.data(), nullptr));
+        std::vector<size_t> sizes(numDevices);
+        detail::checkError(clGetProgramInfo(
+            program, CL_PROGRAM_BINARY_SIZES, numDevices * sizeof(size_t), sizes.data(), nullptr));
+
+        std::vector<std::vector<unsigned char> > binaries(numDevices);
+        std::vector<unsigned char*> binaryPtrs(numDevices);
+        for (cl_uint i = 0; i < numDevices; i++) {
+            binaries[i].resize(sizes[i]);
+            binaryPtrs[i] = binaries[i].data();
+        }
+        detail::checkError(clGetProgramInfo(
+            program, CL_PROGRAM_BINARIES, numDevices * sizeof(unsigned char*), binaryPtrs.data(), nullptr));
+
+        for (cl_uint i = 0; i < numDevices; i++) {
+            if (programDevices[i] == device) return binaries[i];
+        }
+        return std::vector<unsigned char>();
+    }
+
+    // Clones the binary `program` built for `source_device` onto `devices`.
+    // Returns nullptr if the runtime refuses the binary.
+    cl_program cloneProgram(
+        cl_context context, cl_program program, cl_device_id source_device,
+        const std::vector<cl_device_id>& devices, const std::string& options
+    ) {
+        std::vector<unsigned char> binary = getProgramBinary(program, source_device);
+        if (binary.empty()) return nullptr;
+
+        std::vector<size_t> lengths(devices.size(), binary.size());
+        std::vector<const unsigned char*> clones(devices.size(), binary.data());
+        std::vector<cl_int> status(devices.size());
+
+        cl_int error = CL_SUCCESS;
+        cl_program clone = clCreateProgramWithBinary(
+            context, devices.size(), devices.data(),
+            lengths.data(), clones.data(), status.data(), &error);
+        if (error != CL_SUCCESS) return nullptr;
+
+        if (clBuildProgram(clone, devices.size(), devices.data(), options.data(), nullptr, nullptr) != CL_SUCCESS) {
+            clReleaseProgram(clone);
+            return nullptr;
+        }
+        return clone;
+    }
+
+    // Compile options that select a search kernel variant.
+    std::string variantOptions(const std::string& variant) {
+        std::string options;
+        if (variant.find("compact") != std::string::npos) options += "-DCOMPACT_ROUNDS ";
+        if (variant.find("nonce32") != std::string::npos) options += "-DNONCE32 ";
+        return options;
+    }
+
+    // Work items an NVIDIA compute unit holds at once, by compute capability;
+    // 0 on other devices.
+    size_t nvidiaUnitItems(cl_device_id id) {
+        cl_uint major = 0, minor = 0;
+        size_t size = 0;
+        if (clGetDeviceInfo(id, CL_DEVICE_COMPUTE_CAPABILITY_MAJOR_NV, sizeof(major), &major, &size) != CL_SUCCESS
+                || size != sizeof(major)) {
+            return 0;
+        }
+        clGetDeviceInfo(id, CL_DEVICE_COMPUTE_CAPABILITY_MINOR_NV, sizeof(minor), &minor, nullptr);
+        if (major == 2 || (major == 8 && minor > 0)) return 1536;
+        if (major == 7 && minor == 5) return 1024;
+        return 2048;
+    }
+
+    // Work groups of `local_size` that one compute unit runs at once. The
+    // kernel's work group limit accounts for its register use, so a compute
+    // unit holds at least that many work items; NVIDIA devices hold up to
+    // their per SM limit when that is not what binds. Local memory use caps
+    // the count further.
+    size_t unitGroups(cl_device_id id, cl_kernel kernel, size_t local_size) {
+        size_t kernelItems = 0, deviceItems = 0;
+        clGetKernelWorkGroupInfo(kernel, id, CL_KERNEL_WORK_GROUP_SIZE, sizeof(kernelItems), &kernelItems, nullptr);
+        clGetDeviceInfo(id, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(deviceItems), &deviceItems, nullptr);
+        size_t items = kernelItems;
+        size_t nvidia = nvidiaUnitItems(id);
+        if (nvidia > 0 && kernelItems >= deviceItems) items = std::max(items, nvidia);
+        size_t groups = std::max<size_t>(1, items / local_size);
+
+        cl_ulong kernelLocal = 0, deviceLocal = 0;
+        clGetKernelWorkGroupInfo(kernel, id, CL_KERNEL_LOCAL_MEM_SIZE, sizeof(kernelLocal), &kernelLocal, nullptr);
+        clGetDeviceInfo(id, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(deviceLocal), &deviceLocal, nullptr);
+        if (kernelLocal > 0 && deviceLocal >= kernelLocal) groups = std::min<size_t>(groups, deviceLocal / kernelLocal);
+        return groups;
+    }
+
+    // Takes the arguments of search_nonce that the launch sequence touches,
+    // and for LAUNCH_RECORDED those of a -DNONCE_BUFFER build.
+    const char* EMPTY_KERNEL =
+        "kernel void empty_search(ulong start_nonce, global ulong* result_ptr) {}\n"
+        "kernel void empty_recorded(ulong start_nonce, global ulong* result_ptr, global const ulong* nonces) {}\n"
+        "kernel void step_nonce(global ulong* nonces, global ulong* result_ptr, ulong step) {\n"
+        "  nonces[0] = nonces[1];\n"
+        "  nonces[1] += step;\n"
+        "  *result_ptr = 0;\n"
+        "}\n";
+
+    // cl_khr_command_buffer as declared in cl_ext.h, with the command buffer
+    // and mutable command handles as plain pointers.
+    typedef void* (*createCommandBufferFn)(cl_uint, const cl_command_queue*, const cl_bitfield*, cl_int*);
+    typedef cl_int (*finalizeCommandBufferFn)(void*);
+    typedef cl_int (*releaseCommandBufferFn)(void*);
+    typedef cl_int (*enqueueCommandBufferFn)(cl_uint, cl_command_queue*, void*, cl_uint, const cl_event*, cl_event*);
+    typedef cl_int (*commandNDRangeKernelFn)(
+        void*, cl_command_queue, const cl_bitfield*, cl_kernel, cl_uint,
+        const size_t*, const size_t*, const size_t*, cl_uint, const cl_uint*, cl_uint*, void**);
+
+    // Counts the instructions of a PTX binary: every statement that is not a
+    // directive. Other binaries are opaque and count as 0.
+    size_t countPtxInstructions(const std::vector<unsigned char>& binary) {
+        std::string text(binary.begin(), binary.end());
+        if (text.find(".version") == std::string::npos) return 0;
+
+        size_t count = 0;
+        std::istringstream lines(text);
+        std::string line;
+        while (std::getline(lines, line)) {
+            size_t first = line.find_first_not_of(" \t");
+            if (first == std::string::npos || line[first] == '.' || line[first] == '/') continue;
+            size_t last = line.find_last_not_of(" \t\r");
+            if (line[last] == ';') count++;
+        }
+        return count;
     }
 };
 
-opencl_backend::opencl_backend(size_t search_nonce_size, bool quiet, int device_override, int platform_override, char* kernel_path_override) {
-    platform_id = detail::choosePlatform(quiet, platform_override);
-    std::pair<cl_device_id, cl_context> res =
-        detail::chooseDeviceAndCreateContext(platform_id, quiet, device_override);
-    device_id = res.first;
-    context = res.second;
+struct command_buffer_api {
+    detail::createCommandBufferFn create;
+    detail::finalizeCommandBufferFn finalize;
+    detail::releaseCommandBufferFn release;
+    detail::enqueueCommandBufferFn enqueue;
+    detail::commandNDRangeKernelFn ndrange;
+};
+
+namespace detail {
+    // Null if the platform lacks cl_khr_command_buffer or
+    // $BIGOLCHUNGUS_COMMAND_BUFFERS is 0.
+    command_buffer_api* loadCommandBufferApi(cl_platform_id platform) {
+        const char* setting = getenv("BIGOLCHUNGUS_COMMAND_BUFFERS");
+        if (setting != nullptr && std::string(setting) == "0") return nullptr;
+
+        command_buffer_api api;
+        api.create = (createCommandBufferFn) clGetExtensionFunctionAddressForPlatform(
+            platform, "clCreateCommandBufferKHR");
+        api.finalize = (finalizeCommandBufferFn) clGetExtensionFunctionAddressForPlatform(
+            platform, "clFinalizeCommandBufferKHR");
+        api.release = (releaseCommandBufferFn) clGetExtensionFunctionAddressForPlatform(
+            platform, "clReleaseCommandBufferKHR");
+        api.enqueue = (enqueueCommandBufferFn) clGetExtensionFunctionAddressForPlatform(
+            platform, "clEnqueueCommandBufferKHR");
+        api.ndrange = (commandNDRangeKernelFn) clGetExtensionFunctionAddressForPlatform(
+            platform, "clCommandNDRangeKernelKHR");
+        if (!api.create || !api.finalize || !api.release || !api.enqueue || !api.ndrange) return nullptr;
+        return new command_buffer_api(api);
+    }
+
+    // Records `step` on one work item, then `kernel` over `global_size` once
+    // it is done. Null if the runtime refuses any part of it.
+    void* recordLaunch(
+        const command_buffer_api& api, cl_command_queue queue,
+        cl_kernel step, cl_kernel kernel, size_t global_size, size_t local_size
+    ) {
+        cl_int error = CL_SUCCESS;
+        void* recording = api.create(1, &queue, nullptr, &error);
+        if (error != CL_SUCCESS || recording == nullptr) return nullptr;
+
+        size_t one[1] = {1};
+        size_t size[1] = {global_size};
+        size_t local[1] = {local_size};
+        cl_uint stepped = 0;
+        if (api.ndrange(recording, nullptr, nullptr, step, 1, nullptr, one, nullptr, 0, nullptr, &stepped, nullptr) != CL_SUCCESS
+                || api.ndrange(recording, nullptr, nullptr, kernel, 1, nullptr, size, local, 1, &stepped, nullptr, nullptr) != CL_SUCCESS
+                || api.finalize(recording) != CL_SUCCESS) {
+            api.release(recording);
+            return nullptr;
+        }
+        return recording;
+    }
+
+    // Older device time counts less towards the hashing share, so that hours of
+    // searching do not let a burst of hashing jobs take the device for long.
+    const double HASH_SHARE_WINDOW_MS = 10000;
+
+    // Adds `ms` of search or hashing time to the windowed totals of `device`.
+    void accountTime(opencl_device& device, double ms, bool hashing) {
+        double decay = std::exp(-ms / HASH_SHARE_WINDOW_MS);
+        device.search_ms *= decay;
+        device.hash_ms *= decay;
+        (hashing ? device.hash_ms : device.search_ms) += ms;
+    }
+
+    // A blocking search launch of `hashes` nonces, for perf_stats.
+    void countLaunch(
+        std::chrono::high_resolution_clock::time_point t_start,
+        std::chrono::high_resolution_clock::time_point t_end, uint64_t hashes
+    ) {
+        perf_count(PERF_LAUNCHES);
+        perf_count(PERF_HASHES, hashes);
+        perf_record(PERF_LAUNCH_NS, std::chrono::duration_cast<std::chrono::nanoseconds>(t_end - t_start).count());
+    }
+};
+
+opencl_backend::opencl_backend(size_t search_nonce_size, bool quiet, int device_override, int platform_override, char* kernel_path_override)
+    : quiet(quiet) {
+    init(std::vector<int>(1, device_override), platform_override, kernel_path_override);
+}
+
+opencl_backend::opencl_backend(size_t search_nonce_size, bool quiet, const std::vector<int>& device_overrides, int platform_override, char* kernel_path_override)
+    : quiet(quiet) {
+    init(device_overrides, platform_override, kernel_path_override);
+}
+
+void opencl_backend::init(const std::vector<int>& device_overrides, int platform_override, char* kernel_path_override) {
+    auto t_discovery = std::chrono::high_resolution_clock::now();
+
+    // The device cache must be read before the first OpenCL call, which makes
+    // the ICD loader load its vendor libraries.
+    std::string cachePath = device_cache_path();
+    std::vector<platform_fingerprint> cached;
+    const platform_fingerprint* expected = nullptr;
+    bool restricted = false;
+    if (!cachePath.empty() && load_device_cache(cachePath, cached)) {
+        size_t index = platform_override < 0 ? 0 : platform_override;
+        if (index < cached.size()) {
+            expected = &cached[index];
+            restricted = restrict_icd_loading(cachePath, expected->icd_library);
+        } else if (!quiet) {
+            // Nothing is loaded yet, so the full list is still there to renew it from.
+            std::cerr << "Device cache " << cachePath << " is stale, renewing it" << std::endl;
+        }
+    }
+
+    platform_id = detail::choosePlatform(quiet, platform_override, expected);
+    if (!platform_id && restricted) detail::dropStaleDeviceCache(cachePath);
+    std::vector<cl_device_id> chosen;
+    if (platform_id) chosen = detail::chooseDevices(platform_id, quiet, device_overrides, expected);
+    if (chosen.empty()) {
+        if (restricted) detail::dropStaleDeviceCache(cachePath);
+        // Loading was not restricted, so fall back to indices and renew the cache.
+        if (expected && !quiet) std::cerr << "Device cache " << cachePath << " is stale, renewing it" << std::endl;
+        platform_id = detail::choosePlatform(quiet, platform_override, nullptr);
+        chosen = detail::chooseDevices(platform_id, quiet, device_overrides, nullptr);
+        expected = nullptr;
+    }
+    if (!cachePath.empty() && !expected) detail::storeDeviceCache(cachePath, quiet);
+
+    auto t_context = std::chrono::high_resolution_clock::now();
+    context = detail::createContext(platform_id, quiet, chosen);
+    command_buffers = detail::loadCommandBufferApi(platform_id);
 
     if (kernel_path_override) {
       kernel_path = kernel_path_override;
     } else {
-      kernel_path = "kernels/kernel.cl";
+      kernel_path = const_cast<char*>("kernels/kernel.cl");
     }
+    kernel_variant = "unrolled";
+    build_ms = 0;
+    build_bytes = 0;
+    build_instructions = 0;
 
-    if (!quiet) std::cerr << "Creating command queue" << std::endl;
-    // http://www.khronos.org/registry/cl/sdk/1.1/docs/man/xhtml/clCreateCommandQueue.html
-    cl_int error = CL_SUCCESS;
-    queue = clCreateCommandQueue(context, device_id, 0, &error);
-    detail::checkError(error);
+    if (!quiet) std::cerr << "Creating command queue(s)" << std::endl;
+    for (cl_device_id device_id : chosen) {
+        opencl_device device;
+        device.device_id = device_id;
+        device.search_nonce = nullptr;
+        device.hash_batch = nullptr;
+        device.search_ms = 0;
+        device.hash_ms = 0;
+        device.build_key = detail::getBuildKey(device_id);
+        device.program_index = 0;
+        device.compute_units = 0;
+        device.unit_groups = 0;
+        device.wave_size = 0;
+        device.recordable = command_buffers != nullptr
+            && detail::getDeviceString(device_id, CL_DEVICE_EXTENSIONS).find("cl_khr_command_buffer") != std::string::npos;
+
+        // http://www.khronos.org/registry/cl/sdk/1.1/docs/man/xhtml/clCreateCommandQueue.html
+        cl_int error = CL_SUCCESS;
+        device.queue = clCreateCommandQueue(context, device_id, 0, &error);
+        detail::checkError(error);
+        devices.push_back(device);
+    }
+
+    auto t_end = std::chrono::high_resolution_clock::now();
+    discovery_ms = std::chrono::duration<double, std::milli>(t_context - t_discovery).count();
+    context_ms = std::chrono::duration<double, std::milli>(t_end - t_context).count();
 }
 
 opencl_backend::~opencl_backend() {
     stop_search();
-    clReleaseCommandQueue(queue);
+    stop_hashing();
+    for (opencl_device& device : devices) {
+        clReleaseCommandQueue(device.queue);
+    }
     clReleaseContext(context);
+    delete command_buffers;
+}
+
+bool opencl_backend::set_kernel_variant(const std::string& variant) {
+    if (variant != "unrolled" && variant != "compact"
+        && variant != "nonce32" && variant != "compact-nonce32") return false;
+    kernel_variant = variant;
+    return true;
 }
 
 char tohex(int i) {
@@ -168,6 +626,66 @@ char tohex(int i) {
     else assert(0);
 }
 
+std::vector<cl_program> opencl_backend::build_programs(const std::string& options) {
+    std::string source = detail::loadKernel(kernel_path);
+
+    std::vector<cl_program> built;
+    auto t_build = std::chrono::high_resolution_clock::now();
+
+    // Group identical devices so that each group is compiled exactly once.
+    std::vector<std::string> keys;
+    std::vector<std::vector<size_t> > groups;
+    for (size_t i = 0; i < devices.size(); i++) {
+        size_t g = 0;
+        while (g < keys.size() && keys[g] != devices[i].build_key) g++;
+        if (g == keys.size()) {
+            keys.push_back(devices[i].build_key);
+            groups.push_back(std::vector<size_t>());
+        }
+        groups[g].push_back(i);
+        devices[i].program_index = g;
+    }
+
+    for (size_t g = 0; g < groups.size(); g++) {
+        std::vector<cl_device_id> group_devices;
+        for (size_t i : groups[g]) group_devices.push_back(devices[i].device_id);
+        group_devices = detail::uniqueDevices(group_devices);
+
+        auto t_start = std::chrono::high_resolution_clock::now();
+        std::cerr << "Building program for " << group_devices.size() << " device(s): "
+                  << detail::getDeviceName(group_devices[0]) << std::endl;
+
+        cl_program program = detail::buildProgram(
+            context, source, options, std::vector<cl_device_id>(1, group_devices[0]));
+
+        if (g == 0) {
+            std::vector<unsigned char> binary = detail::getProgramBinary(program, group_devices[0]);
+            build_bytes = binary.size();
+            build_instructions = detail::countPtxInstructions(binary);
+        }
+
+        if (group_devices.size() > 1) {
+            cl_program clone = detail::cloneProgram(
+                context, program, group_devices[0], group_devices, options);
+            clReleaseProgram(program);
+            if (clone != nullptr) {
+                program = clone;
+            } else {
+                if (!quiet) std::cerr << "Binary reuse refused, building for every device" << std::endl;
+                program = detail::buildProgram(context, source, options, group_devices);
+            }
+        }
+
+        auto t_end = std::chrono::high_resolution_clock::now();
+        if (!quiet) std::cerr << "Built in "
+            << std::chrono::duration<double, std::milli>(t_end - t_start).count() << " ms" << std::endl;
+        built.push_back(program);
+    }
+    build_ms = std::chrono::duration<double, std::milli>(
+        std::chrono::high_resolution_clock::now() - t_build).count();
+    return built;
+}
+
 void opencl_backend::start_search(
     size_t global_size,
     size_t local_size,
@@ -175,16 +693,6 @@ void opencl_backend::start_search(
     uint8_t* block_data,
     uint8_t* target_hash
 ) {
-    search_nonce = new search_nonce_kernel();
-
-    search_nonce->global_size = global_size;
-    search_nonce->local_size = local_size;
-    search_nonce->workset_size = workset_size;
-
-    std::cerr << "Creating program" << std::endl;
-    // Create a program from source
-    search_nonce->program = detail::createProgram(detail::loadKernel(kernel_path), context);
-
     std::ostringstream ss;
     for (size_t i = 0; i < 320; i+=4) {
         if (i == 0 || i == 4) continue;
@@ -202,46 +710,256 @@ void opencl_backend::start_search(
         ss << "-D" << j << "0=" << (*(uint64_t*)(target_hash + i)) << "UL ";
     }
     ss << "-DWORKSET_SIZE=" << workset_size << " ";
+    ss << detail::variantOptions(kernel_variant);
     ss << "-Werror ";
 
     std::string options = ss.str();
     std::cerr << options << std::endl;
 
-    std::cerr << "Building program" << std::endl;
-    cl_int ret = clBuildProgram(
-        search_nonce->program, 1, &device_id,
-        options.data(), nullptr, nullptr);
+    create_search_kernels(options, global_size, local_size, workset_size);
+}
 
-    if (ret != 0) {
-        size_t len = 0;
-        clGetProgramBuildInfo(search_nonce->program, device_id, CL_PROGRAM_BUILD_LOG, NULL, NULL, &len);
-        char *log = new char[len];
-        clGetProgramBuildInfo(search_nonce->program, device_id, CL_PROGRAM_BUILD_LOG, len, log, NULL);
-        std::cerr << "\n\nBuildlog:\n" << log << "\n\n";
-        delete [] log;
-        detail::checkError (ret);
+void opencl_backend::prepare_search(
+    size_t global_size,
+    size_t local_size,
+    size_t workset_size
+) {
+    std::ostringstream ss;
+    ss << "-DRUNTIME_HEADER ";
+    ss << "-DWORKSET_SIZE=" << workset_size << " ";
+    ss << detail::variantOptions(kernel_variant);
+    ss << "-Werror ";
+
+    create_search_kernels(ss.str(), global_size, local_size, workset_size);
+
+    for (opencl_device& device : devices) {
+        search_nonce_kernel* search_nonce = device.search_nonce;
+        cl_int error;
+        search_nonce->header_buffer = clCreateBuffer(
+            context, CL_MEM_READ_ONLY,
+            320, nullptr, &error);
+        detail::checkError(error);
+        clSetKernelArg(search_nonce->kernel, 2, sizeof(cl_mem), &search_nonce->header_buffer);
+        if (device.recordable) {
+            clSetKernelArg(search_nonce->recorded_kernel, 2, sizeof(cl_mem), &search_nonce->header_buffer);
+        }
     }
+}
 
-    std::cerr << "Creating search_nonce kernel" << std::endl;
-    cl_int error;
-    search_nonce->kernel = clCreateKernel(search_nonce->program, "search_nonce", &error);
-    detail::checkError(error);
+void opencl_backend::set_search_job(uint8_t* block_data, uint8_t* target_hash) {
+    for (opencl_device& device : devices) {
+        search_nonce_kernel* search_nonce = device.search_nonce;
+        detail::checkError(clEnqueueWriteBuffer(
+            device.queue,
+            search_nonce->header_buffer,
+            true,        /* blocking_write */
+            0,           /* offset */
+            320,         /* size */
+            block_data,  /* ptr */
+            0, nullptr, nullptr));
 
-    std::cerr << "Preparing search_nonce buffers" << std::endl;
-    search_nonce->result_buffer = clCreateBuffer(
-        context, CL_MEM_WRITE_ONLY,
-        8, nullptr, &error);
-    detail::checkError(error);
+        // Arguments 3 .. 6 are A0 .. D0, the target from its top word down.
+        for (cl_uint j = 0; j < 4; j++) {
+            clSetKernelArg(search_nonce->kernel, 3 + j, 8, target_hash + 8 * (3 - j));
+        }
+        if (device.recordable) {
+            // The recording holds the old target; continue_search records anew.
+            for (cl_uint j = 0; j < 4; j++) {
+                clSetKernelArg(search_nonce->recorded_kernel, 3 + j, 8, target_hash + 8 * (3 - j));
+            }
+            release_recording(search_nonce);
+        }
+    }
+}
 
-    std::cerr << "Setting search_nonce arguments" << std::endl;
-    clSetKernelArg(search_nonce->kernel, 1, sizeof(cl_mem), &search_nonce->result_buffer);
+void opencl_backend::queue_search_job(size_t device, const uint8_t* block_data, const uint8_t* target_hash) {
+    search_nonce_kernel* search_nonce = devices[device].search_nonce;
+    detail::checkError(clEnqueueWriteBuffer(
+        devices[device].queue, search_nonce->header_buffer, false, 0, 320, block_data, 0, nullptr, nullptr));
+    for (cl_uint j = 0; j < 4; j++) {
+        clSetKernelArg(search_nonce->kernel, 3 + j, 8, target_hash + 8 * (3 - j));
+    }
+    if (devices[device].recordable) {
+        for (cl_uint j = 0; j < 4; j++) {
+            clSetKernelArg(search_nonce->recorded_kernel, 3 + j, 8, target_hash + 8 * (3 - j));
+        }
+        release_recording(search_nonce);
+    }
+}
+
+void opencl_backend::create_search_kernels(
+    const std::string& options,
+    size_t global_size,
+    size_t local_size,
+    size_t workset_size
+) {
+    bool recordable = false;
+    for (const opencl_device& device : devices) recordable = recordable || device.recordable;
+    programs = build_programs(recordable ? options + "-DNONCE_BUFFER " : options);
+    cl_uint nonceArg = options.find("-DRUNTIME_HEADER") != std::string::npos ? 7 : 2;
+
+    for (opencl_device& device : devices) {
+        search_nonce_kernel* search_nonce = new search_nonce_kernel();
+        device.search_nonce = search_nonce;
+
+        search_nonce->global_size = global_size;
+        search_nonce->local_size = local_size;
+        search_nonce->workset_size = workset_size;
+        search_nonce->nonce32 = kernel_variant.find("nonce32") != std::string::npos;
+        search_nonce->header_buffer = nullptr;
+
+        std::cerr << "Creating search_nonce kernel" << std::endl;
+        cl_int error;
+        search_nonce->kernel = clCreateKernel(programs[device.program_index], "search_nonce", &error);
+        detail::checkError(error);
+
+        std::cerr << "Preparing search_nonce buffers" << std::endl;
+        search_nonce->result_buffer = clCreateBuffer(
+            context, CL_MEM_WRITE_ONLY,
+            8, nullptr, &error);
+        detail::checkError(error);
+
+        std::cerr << "Setting search_nonce arguments" << std::endl;
+        clSetKernelArg(search_nonce->kernel, 1, sizeof(cl_mem), &search_nonce->result_buffer);
+        if (recordable) clSetKernelArg(search_nonce->kernel, nonceArg, sizeof(cl_mem), nullptr);
+
+        cl_uint units = 0;
+        clGetDeviceInfo(device.device_id, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(units), &units, nullptr);
+        device.compute_units = std::max<cl_uint>(1, units);
+        device.unit_groups = detail::unitGroups(device.device_id, search_nonce->kernel, local_size);
+        device.wave_size = device.compute_units * device.unit_groups * local_size;
+        search_nonce->global_size = quantize_global_size(&device - &devices[0], global_size);
+        if (!quiet) std::cerr << device.compute_units << " compute units x " << device.unit_groups
+            << " work groups: waves of " << device.wave_size << ", global work size "
+            << search_nonce->global_size << std::endl;
+
+        if (device.recordable) {
+            search_nonce->recorded_kernel = clCreateKernel(programs[device.program_index], "search_nonce", &error);
+            detail::checkError(error);
+            search_nonce->step_kernel = clCreateKernel(programs[device.program_index], "step_nonce", &error);
+            detail::checkError(error);
+            search_nonce->nonce_buffer = clCreateBuffer(context, CL_MEM_READ_WRITE, 16, nullptr, &error);
+            detail::checkError(error);
+
+            uint64_t zero = 0;
+            clSetKernelArg(search_nonce->recorded_kernel, 0, 8, &zero);
+            clSetKernelArg(search_nonce->recorded_kernel, 1, sizeof(cl_mem), &search_nonce->result_buffer);
+            clSetKernelArg(search_nonce->recorded_kernel, nonceArg, sizeof(cl_mem), &search_nonce->nonce_buffer);
+            clSetKernelArg(search_nonce->step_kernel, 0, sizeof(cl_mem), &search_nonce->nonce_buffer);
+            clSetKernelArg(search_nonce->step_kernel, 1, sizeof(cl_mem), &search_nonce->result_buffer);
+        }
+    }
+}
+
+size_t opencl_backend::quantize_global_size(size_t device, size_t global_size) const {
+    size_t wave = devices[device].wave_size;
+    if (wave == 0) return global_size;
+    return std::max(wave, (global_size + wave / 2) / wave * wave);
+}
+
+std::vector<size_t> opencl_backend::wave_sizes() const {
+    std::vector<size_t> waves;
+    for (const opencl_device& device : devices) waves.push_back(device.wave_size);
+    return waves;
+}
+
+// Records the launch sequence of continue_search at `global_size`: step_nonce
+// resets the result and moves the start nonce along, then search_nonce runs.
+// A replay is then one command buffer and the read of the result. A device
+// whose runtime refuses the recording goes back to enqueueing every command.
+bool opencl_backend::record_search(opencl_device& device, size_t global_size) {
+    search_nonce_kernel* search_nonce = device.search_nonce;
+    release_recording(search_nonce);
+
+    uint64_t step = (uint64_t) global_size * search_nonce->workset_size;
+    clSetKernelArg(search_nonce->step_kernel, 2, 8, &step);
+    search_nonce->recording = detail::recordLaunch(
+        *command_buffers, device.queue, search_nonce->step_kernel, search_nonce->recorded_kernel,
+        global_size, search_nonce->local_size);
+    if (search_nonce->recording == nullptr) {
+        if (!quiet) std::cerr << "Command buffer refused, enqueueing every launch" << std::endl;
+        device.recordable = false;
+        return false;
+    }
+
+    uint64_t nonces[2] = {0, 0};
+    detail::checkError(clEnqueueWriteBuffer(
+        device.queue, search_nonce->nonce_buffer, true, 0, 16, nonces, 0, nullptr, nullptr));
+    search_nonce->recorded_size = global_size;
+    search_nonce->recorded_next = 0;
+    return true;
+}
+
+void opencl_backend::release_recording(search_nonce_kernel* search_nonce) {
+    if (search_nonce->recording == nullptr) return;
+    command_buffers->release(search_nonce->recording);
+    search_nonce->recording = nullptr;
+}
+
+void opencl_backend::enqueue_launches(
+    cl_command_queue queue, search_nonce_kernel* search_nonce,
+    uint64_t nonce, size_t global_size
+) {
+    size_t local = search_nonce->local_size;
+    uint64_t count = (uint64_t) global_size * search_nonce->workset_size;
+    uint64_t below = ((uint64_t) 1 << 32) - (nonce & 0xFFFFFFFF);
+
+    std::vector<std::pair<uint64_t, size_t> > launches;
+    if (!search_nonce->nonce32 || count <= below) {
+        launches.push_back(std::make_pair(nonce, global_size));
+    } else {
+        uint64_t group = (uint64_t) local * search_nonce->workset_size;
+        size_t first = (below + group - 1) / group * local;
+        size_t second = (count - below + group - 1) / group * local;
+        launches.push_back(std::make_pair(nonce + below - (uint64_t) first * search_nonce->workset_size, first));
+        launches.push_back(std::make_pair(nonce + below, second));
+    }
+
+    for (const std::pair<uint64_t, size_t>& launch : launches) {
+        // Arguments are captured at enqueue, so the kernel can be relaunched right away.
+        clSetKernelArg(search_nonce->kernel, 0, 8, &launch.first);
+        size_t size[1] = {launch.second};
+        size_t local_size[1] = {local};
+        detail::checkError(clEnqueueNDRangeKernel(
+            queue, search_nonce->kernel, 1, nullptr, size, local_size, 0, nullptr, nullptr));
+    }
 }
 
-uint64_t opencl_backend::continue_search(uint64_t nonce) {
-    clSetKernelArg(search_nonce->kernel, 0, 8, &nonce);
+uint64_t opencl_backend::continue_search(uint64_t nonce, size_t device, size_t global_size) {
+    auto t_start = std::chrono::high_resolution_clock::now();
+    cl_command_queue queue = devices[device].queue;
+    search_nonce_kernel* search_nonce = devices[device].search_nonce;
+    size_t size = global_size != 0 ? global_size : search_nonce->global_size;
+
+    // Record again for a new size only once it is asked for twice in a row, so
+    // that a size that changes with every launch does not re-record each time.
+    if (devices[device].recordable && !search_nonce->nonce32
+            && (search_nonce->recording == nullptr
+                || (size != search_nonce->recorded_size && size == search_nonce->last_size))) {
+        record_search(devices[device], size);
+    }
+    search_nonce->last_size = size;
 
     uint64_t res = 0;
 
+    if (search_nonce->recording != nullptr && size == search_nonce->recorded_size) {
+        if (nonce != search_nonce->recorded_next) {
+            search_nonce->next_nonce = nonce;
+            detail::checkError(clEnqueueWriteBuffer(
+                queue, search_nonce->nonce_buffer, false, 8, 8, &search_nonce->next_nonce, 0, nullptr, nullptr));
+        }
+        detail::checkError(command_buffers->enqueue(0, nullptr, search_nonce->recording, 0, nullptr, nullptr));
+        detail::checkError(clEnqueueReadBuffer(
+            queue, search_nonce->result_buffer, true, 0, 8, &res, 0, nullptr, nullptr));
+        search_nonce->recorded_next = nonce + (uint64_t) size * search_nonce->workset_size;
+
+        auto t_end = std::chrono::high_resolution_clock::now();
+        detail::accountTime(devices[device], std::chrono::duration<double, std::milli>(t_end - t_start).count(), false);
+        detail::countLaunch(t_start, t_end, (uint64_t) size * search_nonce->workset_size);
+        perf_count(PERF_REPLAYS);
+        return res;
+    }
+
     detail::checkError(clEnqueueWriteBuffer(
         queue,
         search_nonce->result_buffer,
@@ -253,14 +971,7 @@ uint64_t opencl_backend::continue_search(uint64_t nonce) {
 
     // std::cerr << "Running the kernel" << std::endl;
 
-    size_t offset[1] = {0};
-    size_t size[1]   = {search_nonce->global_size};
-    size_t local[1]  = {search_nonce->local_size};
-    detail::checkError(
-        clEnqueueNDRangeKernel(
-            queue, search_nonce->kernel,
-            1, offset, size, local,
-            0, nullptr, nullptr));
+    enqueue_launches(queue, search_nonce, nonce, size);
 
     detail::checkError(clEnqueueReadBuffer(
         queue,
@@ -270,13 +981,388 @@ uint64_t opencl_backend::continue_search(uint64_t nonce) {
         8, /* size */
         &res,             /* ptr */
         0, nullptr, nullptr));
+
+    auto t_end = std::chrono::high_resolution_clock::now();
+    detail::accountTime(devices[device], std::chrono::duration<double, std::milli>(t_end - t_start).count(), false);
+    detail::countLaunch(t_start, t_end, (uint64_t) size * search_nonce->workset_size);
     return res;
 }
 
+void opencl_backend::set_pipeline_depth(size_t depth) {
+    for (opencl_device& device : devices) {
+        search_nonce_kernel* search_nonce = device.search_nonce;
+        for (cl_mem buffer : search_nonce->slot_buffers) clReleaseMemObject(buffer);
+        search_nonce->slot_buffers.clear();
+        search_nonce->slot_events.assign(depth, nullptr);
+        search_nonce->slot_results.assign(depth, 0);
+        search_nonce->slot_hashes.assign(depth, 0);
+
+        for (size_t slot = 0; slot < depth; slot++) {
+            cl_int error;
+            search_nonce->slot_buffers.push_back(clCreateBuffer(
+                context, CL_MEM_WRITE_ONLY, 8, nullptr, &error));
+            detail::checkError(error);
+        }
+    }
+}
+
+void opencl_backend::enqueue_search(uint64_t nonce, size_t device, size_t slot, size_t global_size) {
+    static const uint64_t zero = 0;
+    cl_command_queue queue = devices[device].queue;
+    search_nonce_kernel* search_nonce = devices[device].search_nonce;
+
+    detail::checkError(clEnqueueWriteBuffer(
+        queue, search_nonce->slot_buffers[slot], false, 0, 8, &zero, 0, nullptr, nullptr));
+
+    size_t size = global_size != 0 ? global_size : search_nonce->global_size;
+    clSetKernelArg(search_nonce->kernel, 1, sizeof(cl_mem), &search_nonce->slot_buffers[slot]);
+    enqueue_launches(queue, search_nonce, nonce, size);
+    search_nonce->slot_hashes[slot] = (uint64_t) size * search_nonce->workset_size;
+
+    detail::checkError(clEnqueueReadBuffer(
+        queue, search_nonce->slot_buffers[slot], false, 0, 8,
+        &search_nonce->slot_results[slot], 0, nullptr, &search_nonce->slot_events[slot]));
+    clFlush(queue);
+
+    // continue_search binds the single result buffer again.
+    clSetKernelArg(search_nonce->kernel, 1, sizeof(cl_mem), &search_nonce->result_buffer);
+}
+
+uint64_t opencl_backend::wait_search(size_t device, size_t slot) {
+    search_nonce_kernel* search_nonce = devices[device].search_nonce;
+    detail::checkError(clWaitForEvents(1, &search_nonce->slot_events[slot]));
+    clReleaseEvent(search_nonce->slot_events[slot]);
+    search_nonce->slot_events[slot] = nullptr;
+
+    // Counted once done, like a blocking launch; it has no host time of its own.
+    perf_count(PERF_LAUNCHES);
+    perf_count(PERF_HASHES, search_nonce->slot_hashes[slot]);
+    return search_nonce->slot_results[slot];
+}
+
 void opencl_backend::stop_search() {
-    if (search_nonce != nullptr) {
-        clReleaseMemObject(search_nonce->result_buffer);
-        clReleaseKernel(search_nonce->kernel);
-        clReleaseProgram(search_nonce->program);
+    for (opencl_device& device : devices) {
+        if (device.search_nonce != nullptr) {
+            for (cl_mem buffer : device.search_nonce->slot_buffers) clReleaseMemObject(buffer);
+            if (device.search_nonce->header_buffer != nullptr) clReleaseMemObject(device.search_nonce->header_buffer);
+            if (device.search_nonce->recorded_kernel != nullptr) {
+                release_recording(device.search_nonce);
+                clReleaseKernel(device.search_nonce->recorded_kernel);
+                clReleaseKernel(device.search_nonce->step_kernel);
+                clReleaseMemObject(device.search_nonce->nonce_buffer);
+            }
+            clReleaseMemObject(device.search_nonce->result_buffer);
+            clReleaseKernel(device.search_nonce->kernel);
+            delete device.search_nonce;
+            device.search_nonce = nullptr;
+        }
+    }
+    for (cl_program program : programs) {
+        clReleaseProgram(program);
+    }
+    programs.clear();
+}
+
+std::vector<double> opencl_backend::time_empty_launches(
+    size_t device, launch_mode mode, size_t global_size, size_t local_size, double seconds
+) {
+    if (mode == LAUNCH_RECORDED && !devices[device].recordable) return std::vector<double>();
+
+    cl_command_queue queue = devices[device].queue;
+    cl_program program = detail::buildProgram(
+        context, detail::EMPTY_KERNEL, "", std::vector<cl_device_id>(1, devices[device].device_id));
+    cl_int error;
+    cl_kernel kernel = clCreateKernel(program, "empty_search", &error);
+    detail::checkError(error);
+
+    size_t depth = mode == LAUNCH_PIPELINED ? 2 : 1;
+    cl_mem_flags flags = mode == LAUNCH_MAPPED ? CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR : CL_MEM_WRITE_ONLY;
+    std::vector<cl_mem> buffers;
+    for (size_t slot = 0; slot < depth; slot++) {
+        buffers.push_back(clCreateBuffer(context, flags, 8, nullptr, &error));
+        detail::checkError(error);
+    }
+    std::vector<cl_event> events(depth, nullptr);
+    std::vector<uint64_t> results(depth, 0);
+
+    // The sequence continue_search replays, see record_search.
+    cl_kernel recorded = nullptr, step = nullptr;
+    cl_mem nonces = nullptr;
+    void* recording = nullptr;
+    if (mode == LAUNCH_RECORDED) {
+        recorded = clCreateKernel(program, "empty_recorded", &error);
+        detail::checkError(error);
+        step = clCreateKernel(program, "step_nonce", &error);
+        detail::checkError(error);
+        nonces = clCreateBuffer(context, CL_MEM_READ_WRITE, 16, nullptr, &error);
+        detail::checkError(error);
+
+        uint64_t zero = 0;
+        uint64_t stride = global_size;
+        clSetKernelArg(recorded, 0, 8, &zero);
+        clSetKernelArg(recorded, 1, sizeof(cl_mem), &buffers[0]);
+        clSetKernelArg(recorded, 2, sizeof(cl_mem), &nonces);
+        clSetKernelArg(step, 0, sizeof(cl_mem), &nonces);
+        clSetKernelArg(step, 1, sizeof(cl_mem), &buffers[0]);
+        clSetKernelArg(step, 2, 8, &stride);
+        recording = detail::recordLaunch(*command_buffers, queue, step, recorded, global_size, local_size);
+    }
+    auto release = [&]() {
+        if (recording != nullptr) command_buffers->release(recording);
+        if (recorded != nullptr) clReleaseKernel(recorded);
+        if (step != nullptr) clReleaseKernel(step);
+        if (nonces != nullptr) clReleaseMemObject(nonces);
+        for (cl_mem buffer : buffers) clReleaseMemObject(buffer);
+        clReleaseKernel(kernel);
+        clReleaseProgram(program);
+    };
+    if (mode == LAUNCH_RECORDED && recording == nullptr) {
+        release();
+        return std::vector<double>();
+    }
+
+    uint64_t nonce = 0;
+    size_t size[1] = {global_size};
+    size_t local[1] = {local_size};
+    auto enqueueKernel = [&](size_t slot) {
+        clSetKernelArg(kernel, 0, 8, &nonce);
+        clSetKernelArg(kernel, 1, sizeof(cl_mem), &buffers[slot]);
+        detail::checkError(clEnqueueNDRangeKernel(queue, kernel, 1, nullptr, size, local, 0, nullptr, nullptr));
+        nonce += global_size;
+    };
+
+    // One launch of the sequence; LAUNCH_PIPELINED only issues it.
+    auto launch = [&](size_t slot) {
+        static const uint64_t zero = 0;
+        uint64_t res = 0;
+        if (mode == LAUNCH_BLOCKING) {
+            detail::checkError(clEnqueueWriteBuffer(queue, buffers[slot], true, 0, 8, &res, 0, nullptr, nullptr));
+            enqueueKernel(slot);
+            detail::checkError(clEnqueueReadBuffer(queue, buffers[slot], true, 0, 8, &res, 0, nullptr, nullptr));
+        } else if (mode == LAUNCH_MAPPED) {
+            uint64_t* ptr = (uint64_t*) clEnqueueMapBuffer(
+                queue, buffers[slot], true, CL_MAP_WRITE_INVALIDATE_REGION, 0, 8, 0, nullptr, nullptr, &error);
+            detail::checkError(error);
+            *ptr = 0;
+            detail::checkError(clEnqueueUnmapMemObject(queue, buffers[slot], ptr, 0, nullptr, nullptr));
+            enqueueKernel(slot);
+            ptr = (uint64_t*) clEnqueueMapBuffer(
+                queue, buffers[slot], true, CL_MAP_READ, 0, 8, 0, nullptr, nullptr, &error);
+            detail::checkError(error);
+            res = *ptr;
+            detail::checkError(clEnqueueUnmapMemObject(queue, buffers[slot], ptr, 0, nullptr, nullptr));
+        } else if (mode == LAUNCH_RECORDED) {
+            detail::checkError(command_buffers->enqueue(0, nullptr, recording, 0, nullptr, nullptr));
+            detail::checkError(clEnqueueReadBuffer(queue, buffers[slot], true, 0, 8, &res, 0, nullptr, nullptr));
+        } else {
+            detail::checkError(clEnqueueWriteBuffer(queue, buffers[slot], false, 0, 8, &zero, 0, nullptr, nullptr));
+            enqueueKernel(slot);
+            detail::checkError(clEnqueueReadBuffer(
+                queue, buffers[slot], false, 0, 8, &results[slot], 0, nullptr, &events[slot]));
+            clFlush(queue);
+        }
+    };
+    auto wait = [&](size_t slot) {
+        if (events[slot] == nullptr) return;
+        detail::checkError(clWaitForEvents(1, &events[slot]));
+        clReleaseEvent(events[slot]);
+        events[slot] = nullptr;
+    };
+
+    // Warm up, so that lazy driver initialization is not measured.
+    for (size_t i = 0; i < 16; i++) {
+        launch(i % depth);
+        wait(i % depth);
+    }
+
+    std::vector<double> samples;
+    auto t_start = std::chrono::high_resolution_clock::now();
+    auto elapsed = [&]() {
+        return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - t_start).count();
+    };
+    if (mode == LAUNCH_PIPELINED) {
+        for (size_t slot = 0; slot < depth; slot++) launch(slot);
+        auto t_last = std::chrono::high_resolution_clock::now();
+        for (size_t slot = 0; ; slot = (slot + 1) % depth) {
+            wait(slot);
+            auto now = std::chrono::high_resolution_clock::now();
+            samples.push_back(std::chrono::duration<double, std::milli>(now - t_last).count());
+            t_last = now;
+            if (elapsed() >= seconds) break;
+            launch(slot);
+        }
+        for (size_t slot = 0; slot < depth; slot++) wait(slot);
+    } else {
+        while (elapsed() < seconds) {
+            auto t_launch = std::chrono::high_resolution_clock::now();
+            launch(0);
+            auto now = std::chrono::high_resolution_clock::now();
+            samples.push_back(std::chrono::duration<double, std::milli>(now - t_launch).count());
+        }
+    }
+
+    release();
+    return samples;
+}
+
+void opencl_backend::start_hashing(size_t max_batch_bytes, size_t max_batch_messages) {
+    hash_programs = build_programs("-DBATCH_HASH -Werror ");
+
+    for (opencl_device& device : devices) {
+        hash_batch_kernel* hash_batch = new hash_batch_kernel();
+        device.hash_batch = hash_batch;
+        hash_batch->max_bytes = max_batch_bytes;
+        hash_batch->max_messages = max_batch_messages;
+
+        cl_int error;
+        hash_batch->kernel = clCreateKernel(hash_programs[device.program_index], "hash_batch", &error);
+        detail::checkError(error);
+
+        for (int slot = 0; slot < 2; slot++) {
+            hash_batch->queues[slot] = clCreateCommandQueue(context, device.device_id, 0, &error);
+            detail::checkError(error);
+            hash_batch->data_buffers[slot] = clCreateBuffer(
+                context, CL_MEM_READ_ONLY, max_batch_bytes, nullptr, &error);
+            detail::checkError(error);
+            hash_batch->offset_buffers[slot] = clCreateBuffer(
+                context, CL_MEM_READ_ONLY, (max_batch_messages + 1) * sizeof(uint32_t), nullptr, &error);
+            detail::checkError(error);
+            hash_batch->digest_buffers[slot] = clCreateBuffer(
+                context, CL_MEM_WRITE_ONLY, max_batch_messages * 32, nullptr, &error);
+            detail::checkError(error);
+        }
+    }
+}
+
+void opencl_backend::hash_messages(
+    const uint8_t* data, const uint32_t* offsets, size_t count,
+    uint8_t* digests, size_t device
+) {
+    auto t_start = std::chrono::high_resolution_clock::now();
+    hash_batch_kernel* hash_batch = devices[device].hash_batch;
+
+    // Offsets are rebased per chunk, so each slot keeps its own copy alive
+    // until the chunk that uses it has been read back.
+    std::vector<uint32_t> chunk_offsets[2];
+    cl_event pending[2] = { nullptr, nullptr };
+
+    size_t first = 0;
+    for (int slot = 0; first < count; slot ^= 1) {
+        if (pending[slot] != nullptr) {
+            detail::checkError(clWaitForEvents(1, &pending[slot]));
+            clReleaseEvent(pending[slot]);
+            pending[slot] = nullptr;
+        }
+
+        // Take as many messages as fit into one slot.
+        size_t last = first;
+        while (last < count
+               && last - first < hash_batch->max_messages
+               && offsets[last + 1] - offsets[first] <= hash_batch->max_bytes) {
+            last++;
+        }
+        if (last == first) {
+            std::cerr << "Message " << first << " exceeds the hashing batch size" << std::endl;
+            std::exit(1);
+        }
+
+        uint32_t n = last - first;
+        uint32_t base = offsets[first];
+        size_t bytes = offsets[last] - base;
+        chunk_offsets[slot].resize(n + 1);
+        for (uint32_t i = 0; i <= n; i++) chunk_offsets[slot][i] = offsets[first + i] - base;
+
+        cl_command_queue queue = hash_batch->queues[slot];
+        if (bytes > 0) {
+            detail::checkError(clEnqueueWriteBuffer(
+                queue, hash_batch->data_buffers[slot], false, 0, bytes, data + base, 0, nullptr, nullptr));
+        }
+        detail::checkError(clEnqueueWriteBuffer(
+            queue, hash_batch->offset_buffers[slot], false, 0, (n + 1) * sizeof(uint32_t),
+            chunk_offsets[slot].data(), 0, nullptr, nullptr));
+
+        // Both slots share the kernel object; arguments are captured at enqueue.
+        clSetKernelArg(hash_batch->kernel, 0, sizeof(cl_mem), &hash_batch->data_buffers[slot]);
+        clSetKernelArg(hash_batch->kernel, 1, sizeof(cl_mem), &hash_batch->offset_buffers[slot]);
+        clSetKernelArg(hash_batch->kernel, 2, sizeof(uint32_t), &n);
+        clSetKernelArg(hash_batch->kernel, 3, sizeof(cl_mem), &hash_batch->digest_buffers[slot]);
+
+        size_t local = 64;
+        size_t global = (n + local - 1) / local * local;
+        detail::checkError(clEnqueueNDRangeKernel(
+            queue, hash_batch->kernel, 1, nullptr, &global, &local, 0, nullptr, nullptr));
+        detail::checkError(clEnqueueReadBuffer(
+            queue, hash_batch->digest_buffers[slot], false, 0, n * 32,
+            digests + 32 * first, 0, nullptr, &pending[slot]));
+        clFlush(queue);
+
+        first = last;
+    }
+
+    for (int slot = 0; slot < 2; slot++) {
+        if (pending[slot] != nullptr) {
+            detail::checkError(clWaitForEvents(1, &pending[slot]));
+            clReleaseEvent(pending[slot]);
+        }
+    }
+
+    auto t_end = std::chrono::high_resolution_clock::now();
+    detail::accountTime(devices[device], std::chrono::duration<double, std::milli>(t_end - t_start).count(), true);
+    perf_count(PERF_HASH_BATCHES);
+    perf_count(PERF_HASH_MESSAGES, count);
+    perf_record(PERF_HASH_BATCH_NS, std::chrono::duration_cast<std::chrono::nanoseconds>(t_end - t_start).count());
+}
+
+bool opencl_backend::hashable(const uint32_t* offsets, size_t count) const {
+    size_t max_bytes = devices[0].hash_batch->max_bytes;
+    for (size_t k = 0; k < count; k++) {
+        if (offsets[k + 1] - offsets[k] > max_bytes) return false;
+    }
+    return true;
+}
+
+void opencl_backend::stop_hashing() {
+    for (opencl_device& device : devices) {
+        hash_batch_kernel* hash_batch = device.hash_batch;
+        if (hash_batch == nullptr) continue;
+        for (int slot = 0; slot < 2; slot++) {
+            clReleaseMemObject(hash_batch->data_buffers[slot]);
+            clReleaseMemObject(hash_batch->offset_buffers[slot]);
+            clReleaseMemObject(hash_batch->digest_buffers[slot]);
+            clReleaseCommandQueue(hash_batch->queues[slot]);
+        }
+        clReleaseKernel(hash_batch->kernel);
+        delete hash_batch;
+        device.hash_batch = nullptr;
+    }
+    for (cl_program program : hash_programs) {
+        clReleaseProgram(program);
+    }
+    hash_programs.clear();
+}
+
+void opencl_backend::submit_hashes(hash_job* job) {
+    std::lock_guard<std::mutex> lock(hash_jobs_mutex);
+    hash_jobs.push_back(job);
+}
+
+bool opencl_backend::service_hashing(size_t device, double share) {
+    opencl_device& dev = devices[device];
+    if (dev.hash_batch == nullptr) return false;
+
+    bool ran = false;
+    // A share of 0 never takes time from a running search.
+    while (share > 0 && dev.hash_ms <= share * (dev.hash_ms + dev.search_ms)) {
+        hash_job* job;
+        {
+            std::lock_guard<std::mutex> lock(hash_jobs_mutex);
+            if (hash_jobs.empty()) break;
+            job = hash_jobs.front();
+            hash_jobs.pop_front();
+        }
+        hash_messages(job->data, job->offsets, job->count, job->digests, device);
+        job->done.set_value();
+        ran = true;
     }
+    return ran;
 }
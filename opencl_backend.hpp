@@ -1,3 +1,5 @@
+#pragma once
+
 #ifdef __APPLE__
     #define CL_SILENCE_DEPRECATION
     #include <OpenCL/opencl.h>
@@ -5,27 +7,125 @@
     #include "CL/cl.h"
 #endif
 
+#include <deque>
+#include <future>
+#include <mutex>
+#include <string>
+#include <vector>
+
 struct search_nonce_kernel {
-    cl_program program;
     cl_kernel kernel;
     cl_mem result_buffer;
+    cl_mem header_buffer;   // only set for kernels built by prepare_search
     size_t global_size;
     size_t local_size;
     size_t workset_size;
+    bool nonce32;           // built with -DNONCE32, see enqueue_launches
+
+    // Launches in flight through enqueue_search / wait_search, one per slot.
+    std::vector<cl_mem> slot_buffers;
+    std::vector<cl_event> slot_events;
+    std::vector<uint64_t> slot_results;
+    std::vector<uint64_t> slot_hashes;      // nonces each slot searches, for perf_stats
+
+    // continue_search replayed from a command buffer, see record_search.
+    // recorded_kernel is search_nonce reading its nonce from nonce_buffer.
+    cl_kernel recorded_kernel;
+    cl_kernel step_kernel;
+    cl_mem nonce_buffer;
+    void* recording;          // cl_command_buffer_khr, null if none
+    size_t recorded_size;     // global size of the recording
+    size_t last_size;         // global size of the last continue_search
+    uint64_t recorded_next;   // where the next replay starts
+    uint64_t next_nonce;      // nonce_buffer[1] when it needs rewriting
 };
 
+// Double-buffered state for hashing message batches. Consecutive chunks
+// alternate between the two slots, each with its own queue, so that the
+// upload of chunk k + 1 overlaps the kernel of chunk k.
+struct hash_batch_kernel {
+    cl_kernel kernel;
+    cl_command_queue queues[2];
+    cl_mem data_buffers[2];
+    cl_mem offset_buffers[2];
+    cl_mem digest_buffers[2];
+    size_t max_bytes;
+    size_t max_messages;
+};
+
+// A batch of messages queued for hashing in between search steps.
+struct hash_job {
+    const uint8_t* data;
+    const uint32_t* offsets;
+    size_t count;
+    uint8_t* digests;
+    std::promise<void> done;
+};
+
+struct opencl_device {
+    cl_device_id device_id;
+    cl_command_queue queue;
+    search_nonce_kernel* search_nonce;
+    hash_batch_kernel* hash_batch;
+
+    // Host time spent on each kind of work over about the last
+    // HASH_SHARE_WINDOW_MS of both, used to enforce the hashing share.
+    double search_ms;
+    double hash_ms;
+
+    // Devices with the same build_key share one compiled program.
+    std::string build_key;
+    size_t program_index;
+
+    // Whether continue_search may replay a recorded command buffer
+    // (cl_khr_command_buffer) instead of enqueueing each command.
+    bool recordable;
+
+    // Occupancy of search_nonce: a wave is unit_groups work groups on each of
+    // the compute_units, wave_size work items in all. Set by start_search and
+    // prepare_search.
+    size_t compute_units;
+    size_t unit_groups;
+    size_t wave_size;
+};
+
+// Entry points of cl_khr_command_buffer, null if the platform has none.
+struct command_buffer_api;
+
+// How time_empty_launches drives the queue:
+//   LAUNCH_BLOCKING   continue_search: blocking write, NDRange, blocking read
+//   LAUNCH_PIPELINED  enqueue_search / wait_search with two launches in flight
+//   LAUNCH_MAPPED     the blocking sequence through a mapped host buffer
+//   LAUNCH_RECORDED   the blocking sequence replayed from a command buffer
+enum launch_mode { LAUNCH_BLOCKING, LAUNCH_PIPELINED, LAUNCH_MAPPED, LAUNCH_RECORDED };
+
 struct opencl_backend {
     cl_platform_id platform_id;
-    cl_device_id device_id;
     cl_context context;
-    cl_command_queue queue;
+    std::vector<opencl_device> devices;
+    std::vector<cl_program> programs;
+    std::vector<cl_program> hash_programs;
+    std::deque<hash_job*> hash_jobs;
+    std::mutex hash_jobs_mutex;
     char* kernel_path;
-
-    search_nonce_kernel* search_nonce;
+    std::string kernel_variant;
+    double discovery_ms; // platform and device selection in the constructor
+    double context_ms;   // context and command queue creation
+    double build_ms;   // time spent in the last build_programs
+    size_t build_bytes; // binary size of the first program of the last build
+    size_t build_instructions; // its instruction count, if the binary is PTX
+    bool quiet;
+    command_buffer_api* command_buffers;
 
     opencl_backend(size_t search_nonce_size, bool quiet, int device_override, int platform_override, char* kernel_path_override);
+    opencl_backend(size_t search_nonce_size, bool quiet, const std::vector<int>& device_overrides, int platform_override, char* kernel_path_override);
     ~opencl_backend();
 
+    // Selects the form of the search kernel for the next start_search or
+    // prepare_search: `unrolled` (default), `compact`, `nonce32` or
+    // `compact-nonce32`. Returns false for an unknown variant.
+    bool set_kernel_variant(const std::string& variant);
+
     void start_search(
         size_t global_size,
         size_t local_size,
@@ -33,6 +133,82 @@ struct opencl_backend {
         uint8_t* block_data,
         uint8_t* target_hash
     );
-    uint64_t continue_search(uint64_t nonce);
+    // Returns a nonce that meets the target, or 0. With nonce32 a launch that
+    // crosses 2^32 may also return one just outside its range; see
+    // stray_solution.
+    uint64_t continue_search(uint64_t nonce, size_t device = 0, size_t global_size = 0);
+
+    // Builds a kernel that reads the header and target at run time, so that
+    // the same build serves every job. Each job is then installed with
+    // set_search_job, which takes the zero padded 320 byte block.
+    void prepare_search(
+        size_t global_size,
+        size_t local_size,
+        size_t workset_size
+    );
+    void set_search_job(uint8_t* block_data, uint8_t* target_hash);
+
+    // Like set_search_job for one device, without waiting: launches enqueued
+    // afterwards search the new job while earlier ones finish the old one.
+    // `block_data` must stay valid until the next launch has run.
+    void queue_search_job(size_t device, const uint8_t* block_data, const uint8_t* target_hash);
+
+    // `global_size` rounded to the nearest whole number of waves of `device`,
+    // at least one, so that no compute unit idles through the end of a launch.
+    // start_search and prepare_search round the configured size this way.
+    size_t quantize_global_size(size_t device, size_t global_size) const;
+    std::vector<size_t> wave_sizes() const;
+
+    // Pipelined search: up to `depth` launches per device are kept in flight,
+    // each identified by its slot. A global_size of 0 uses the configured one.
+    void set_pipeline_depth(size_t depth);
+    void enqueue_search(uint64_t nonce, size_t device, size_t slot, size_t global_size = 0);
+    uint64_t wait_search(size_t device, size_t slot);
+
+    // Releases the search kernels and programs only; the hashing kernels
+    // stay usable until stop_hashing.
     void stop_search();
+
+    // Launch overhead probe: runs the host side of a search launch around an
+    // empty kernel of `global_size` work items on `device` for `seconds`, and
+    // returns the cost of each launch in ms. For LAUNCH_PIPELINED that is the
+    // time between completions, otherwise the round trip. Empty for
+    // LAUNCH_RECORDED on devices that are not recordable.
+    std::vector<double> time_empty_launches(
+        size_t device, launch_mode mode, size_t global_size, size_t local_size, double seconds);
+
+    // Bulk Blake2s-256 hashing. Message k is data[offsets[k] .. offsets[k + 1])
+    // and its digest is written to digests[32 * k .. 32 * k + 32).
+    void start_hashing(size_t max_batch_bytes, size_t max_batch_messages);
+    void hash_messages(
+        const uint8_t* data, const uint32_t* offsets, size_t count,
+        uint8_t* digests, size_t device = 0);
+    void stop_hashing();
+
+    // Whether every message fits into a batch of start_hashing's size;
+    // hash_messages exits on one that does not.
+    bool hashable(const uint32_t* offsets, size_t count) const;
+
+    // Queues a job for service_hashing(); wait on job->done for the digests.
+    void submit_hashes(hash_job* job);
+
+    // Runs queued hashing jobs on `device` as long as hashing stays within
+    // `share` (0..1) of the time the device recently spent on search and
+    // hashing; none at 0. Returns whether any job was run.
+    bool service_hashing(size_t device, double share);
+
+private:
+    void init(const std::vector<int>& device_overrides, int platform_override, char* kernel_path_override);
+    std::vector<cl_program> build_programs(const std::string& options);
+    void enqueue_launches(
+        cl_command_queue queue, search_nonce_kernel* search_nonce,
+        uint64_t nonce, size_t global_size);
+    bool record_search(opencl_device& device, size_t global_size);
+    void release_recording(search_nonce_kernel* search_nonce);
+    void create_search_kernels(
+        const std::string& options,
+        size_t global_size,
+        size_t local_size,
+        size_t workset_size
+    );
 };
@@ -0,0 +1,207 @@
+#include <cstdio>
+#include <cstring>
+#include <cassert>
+#include <string>
+#include <unistd.h>
+
+#include "common.h"
+#include "options.hpp"
+
+void usage() {
+  fprintf(
+    stderr,
+    "  bigolchungus.sh [ -d <device id(s)>      ]\n"
+    "                  [ -p <platform id>       ]\n"
+    "                  [ -l <local work size>   ]\n"
+    "                  [ -w <work set size      ]\n"
+    "                  [ -g <global work size>  ]\n"
+    "                  [ -k <kernel location>   ]\n"
+    "                  [ -V <kernel variant>    ]\n"
+    "                  [ -n <hexadecimal nonce> ]\n"
+    "                  [ -s                     ]\n"
+    "                  [ -c <max launch ms>     ]\n"
+    "                  [ -u <duty cycle %%>      ]\n"
+    "                  [ -v                     ]\n"
+    "                  <block>\n"
+    "  bigolchungus.sh -H [ -d ... ] [ -p ... ] [ -k ... ]\n"
+    "  bigolchungus.sh -B <batch file> [ -d ... ] [ -p ... ] [ -l ... ] [ -w ... ]\n"
+    "                  [ -g ... ] [ -k ... ] [ -V ... ] [ -n ... ]\n\n"
+    "  1. Device Selection\n\n"
+    "    -d <device id(s)>\n"
+    "      Default `0`\n"
+    "      A comma separated list (e.g. `0,1,2`) mines on several devices of the same\n"
+    "      platform from one process. Identical devices are compiled for only once.\n"
+    "      Listing a device twice drives it from two host threads.\n\n"
+    "    -p <platform id>\n"
+    "      Default `0`\n\n"
+    "    Run `clinfo -l` to get info about your device and platform ids.\n\n"
+    "  2. Open CL work configuration \n\n"
+    "    -l <local work size> \n"
+    "      Default `256`.\n\n"
+    "      If you are on AMD, `256` is probably the best value for you.\n"
+    "      If you are on nVidia, you probably want `1024`.\n\n"
+    "    -w <work set size> \n"
+    "      Default `64`\n\n"
+    "    -g <global work size>\n"
+    "      Default `16777216` (1024 * 1024 * 16)\n"
+    "      Rounded to the nearest whole number of waves, the work groups that all\n"
+    "      compute units of the device run at once, so that none idles through the\n"
+    "      end of a launch. `chungus-bench -Q` shows what that gains.\n\n"
+    "    -k <kernel location>\n"
+    "      If you are getting opencl error -46 or -30, try setting this to the absolute path of the `kernel.cl` file.\n"
+    "      Defaults to ./kernels/kernel.cl\n\n"
+    "    -V <kernel variant>\n"
+    "      Default `unrolled`\n"
+    "      `compact` loops over the rounds instead of unrolling them, which makes for a\n"
+    "      much smaller kernel that compiles faster. `tuned` uses the variant and work\n"
+    "      sizes that `chungus-bench -A` found best for the (first) device, overriding\n"
+    "      -l, -w and -g.\n"
+    "      `nonce32` (or `compact-nonce32`) only does 32-bit integer arithmetic, for\n"
+    "      devices that emulate 64-bit integers.\n\n"
+    "  3. Debugging\n\n"
+    "    -v\n"
+    "      enable verbose mode.\n\n"
+    "  4. Advanced\n\n"
+    "    -H\n"
+    "      Hash mode. Reads one hexadecimal message per line from stdin and prints its\n"
+    "      Blake2s-256 digest. The messages are split evenly between the selected\n"
+    "      devices.\n\n"
+    "    -B <batch file>\n"
+    "      Batch mode. Solves every header of the file, one `<target> <header>` pair\n"
+    "      of hexadecimal strings per line, and prints `<nonce> <hashes>` for each in\n"
+    "      file order, then the headers solved per second on stderr. Each device\n"
+    "      solves its own headers; launches cover about the number of hashes a\n"
+    "      header needs, up to -g. Lines of test/corpus.txt work too.\n\n"
+    "    -n <hexadecimal nonce>\n"
+    "      Manually sets a nonce for hashing.\n"
+    "      In the unlikely case that your mining host provides a nonce, use this.\n"
+    "      If you are trying to get reproducible tests, use this.\n\n"
+    "  5. Sharing the GPU\n\n"
+    "    For GPUs that also drive a display or run other jobs.\n\n"
+    "    -c <max launch ms>\n"
+    "      Caps the duration of a single launch by shrinking the global work size as\n"
+    "      needed. Other work on the GPU waits at most about this long.\n\n"
+    "    -u <duty cycle %%>\n"
+    "      Leaves the GPU idle between launches so that mining takes only this share\n"
+    "      of its time. Default `100`\n\n"
+    "    Launch durations, the gaps between launches and the hashrate given up are\n"
+    "    reported on stderr. With chungus-client both change the settings of the\n"
+    "    running daemon; leave out the <block> to only change them.\n\n"
+  );
+
+}
+
+void read_target_bytes(const char* str, uint8_t* target) {
+    assert(strlen(str) == 64);
+    for (size_t i = 0; i < 32; i++) {
+        uint8_t c1 = hexchar2int(str[2 * i]);
+        uint8_t c2 = hexchar2int(str[2 * i + 1]);
+        target[i] = (c1 << 4) | c2;
+    }
+}
+
+miner_options parse_options(int argc, char* const* argv) {
+    miner_options options;
+    options.quiet = true;
+    options.device_overrides.assign(1, 0);
+    options.platform_override = -1;
+    options.local_work_size = 256;
+    options.work_set_size = 64;
+    options.global_size = 1024 * 1024 * 16;
+    options.nonce_override = 0;
+    options.nonce_overridden = false;
+    options.shared_nonces = false;
+    options.hash_mode = false;
+    options.batch_path = nullptr;
+    options.kernel_path = nullptr;
+    options.kernel_variant = nullptr;
+    options.max_launch_ms = 0;
+    options.duty_cycle = 1;
+    options.cotenant = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "d:p:l:w:g:k:V:n:c:u:svHB:h")) != -1) {
+      switch(opt) {
+        case 'd':
+          options.device_overrides = parse_int_list(optarg);
+          break;
+        case 'p':
+          options.platform_override = std::stoi(optarg);
+          break;
+        case 'l':
+          options.local_work_size = std::stoi(optarg);
+          break;
+        case 'w':
+          options.work_set_size = std::stoi(optarg);
+          break;
+        case 'g':
+          options.global_size = std::stoi(optarg);
+          break;
+        case 'k':
+          options.kernel_path = optarg;
+          break;
+        case 'V':
+          options.kernel_variant = optarg;
+          break;
+        case 'v':
+          options.quiet = false;
+          break;
+        case 'n':
+          options.nonce_overridden = true;
+          options.nonce_override = std::stoull(optarg, 0, 16);
+          break;
+        case 's':
+          options.shared_nonces = true;
+          break;
+        case 'c':
+          options.cotenant = true;
+          options.max_launch_ms = std::stod(optarg);
+          break;
+        case 'u':
+          options.cotenant = true;
+          options.duty_cycle = std::stod(optarg) / 100.0;
+          break;
+        case 'H':
+          options.hash_mode = true;
+          break;
+        case 'B':
+          options.batch_path = optarg;
+          break;
+        case 'h':
+        case '?':
+          usage();
+          exit(1);
+          break;
+      }
+    }
+
+    options.target = optind < argc ? argv[optind] : nullptr;
+    return options;
+}
+
+size_t read_block(FILE* in, uint8_t* buf, bool quiet) {
+    if (!quiet) fprintf(stderr, "Reading buf\n");
+    const size_t BUF_SIZE = 4 * 1024;
+    uint8_t data[BUF_SIZE];
+    size_t bufsize = fread(data, 1, BUF_SIZE, in);
+    assert(bufsize >= 8);
+    assert(bufsize < BUF_SIZE);
+
+    if (!quiet) {
+        fprintf(stderr, "hash = ");
+        for (int i = 0; i < bufsize; i++) {
+            fprintf(stderr, "%#x,", data[i]);
+        }
+        fprintf(stderr, "\n");
+    }
+
+    if (!quiet) fprintf(stderr, "bufsize = %d\n", bufsize);
+
+    assert(320 - 64 + 1 <= bufsize && bufsize <= 320);
+    uint32_t last_block_size = bufsize - (320-64);
+    memcpy(buf, data, bufsize);
+    memset(buf + 256 + last_block_size, 0, 64 - last_block_size);
+
+    if (!quiet) fprintf(stderr, "last_block_size = %d\n", last_block_size);
+    return bufsize;
+}
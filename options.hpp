@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+// Command line of the miner. The launcher shim accepts exactly the same
+// flags, so both parse them here.
+struct miner_options {
+    bool quiet;
+    std::vector<int> device_overrides;
+    int platform_override;
+    int local_work_size;
+    int work_set_size;
+    int global_size;
+    uint64_t nonce_override;
+    bool nonce_overridden;
+    bool shared_nonces;
+    bool hash_mode;
+    const char* batch_path;   // -B, nullptr if not given
+    double max_launch_ms;   // co-tenant mode, 0 for no cap
+    double duty_cycle;      // co-tenant mode, 1 for no pauses
+    bool cotenant;          // -c or -u given
+    char* kernel_path;
+    const char* kernel_variant;   // nullptr if not given
+    const char* target;   // the <block> argument, nullptr if missing
+};
+
+void usage();
+miner_options parse_options(int argc, char* const* argv);
+
+void read_target_bytes(const char* str, uint8_t* target);
+
+// Reads a header from `in` into the 320 byte `buf` and zero pads it to the
+// last block. Returns the header size.
+size_t read_block(FILE* in, uint8_t* buf, bool quiet);
@@ -0,0 +1,145 @@
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#include "perf_stats.hpp"
+
+namespace detail {
+    // One thread's counts. The alignment keeps two threads' slots off each
+    // other's cache lines.
+    struct alignas(64) perfSlot {
+        std::atomic<uint64_t> counters[PERF_COUNTERS];
+        std::atomic<uint64_t> buckets[PERF_HISTOGRAMS][PERF_BUCKETS];
+    };
+
+    // Never destroyed, so that threads still running at exit can use it.
+    struct perfRegistry {
+        std::mutex mutex;
+        std::vector<perfSlot*> slots;
+        std::vector<perfSlot*> idle;
+    };
+
+    perfRegistry& registry() {
+        static perfRegistry* instance = new perfRegistry();
+        return *instance;
+    }
+
+    perfSlot* acquireSlot() {
+        perfRegistry& r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        if (!r.idle.empty()) {
+            perfSlot* slot = r.idle.back();
+            r.idle.pop_back();
+            return slot;
+        }
+        // operator new need not honour alignas(64) before C++17.
+        void* memory = nullptr;
+        if (posix_memalign(&memory, alignof(perfSlot), sizeof(perfSlot)) != 0) throw std::bad_alloc();
+        memset(memory, 0, sizeof(perfSlot));
+        perfSlot* slot = new (memory) perfSlot;
+        r.slots.push_back(slot);
+        return slot;
+    }
+
+    // Returns the thread's slot to the registry when the thread exits.
+    struct perfLease {
+        perfSlot* slot;
+        perfLease() : slot(acquireSlot()) {}
+        ~perfLease() {
+            perfRegistry& r = registry();
+            std::lock_guard<std::mutex> lock(r.mutex);
+            r.idle.push_back(slot);
+        }
+    };
+
+    thread_local perfSlot* threadSlot = nullptr;
+
+    inline perfSlot* slot() {
+        if (threadSlot == nullptr) {
+            thread_local perfLease lease;
+            threadSlot = lease.slot;
+        }
+        return threadSlot;
+    }
+
+    // Only this thread writes to its slot, so a plain load and store will
+    // do; no locked instruction, no cache line taken from another core.
+    inline void add(std::atomic<uint64_t>& value, uint64_t n) {
+        value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+};
+
+void perf_count(perf_counter counter, uint64_t n) {
+    detail::add(detail::slot()->counters[counter], n);
+}
+
+void perf_record(perf_histogram histogram, uint64_t ns) {
+    detail::add(detail::slot()->buckets[histogram][perf_bucket(ns)], 1);
+}
+
+size_t perf_bucket(uint64_t ns) {
+    if (ns < (1u << PERF_SUB_BITS)) return ns;
+    unsigned exponent = 63 - __builtin_clzll(ns);
+    size_t sub = (ns >> (exponent - PERF_SUB_BITS)) & ((1u << PERF_SUB_BITS) - 1);
+    return ((exponent - PERF_SUB_BITS + 1) << PERF_SUB_BITS) + sub;
+}
+
+uint64_t perf_bucket_floor(size_t bucket) {
+    if (bucket < (1u << PERF_SUB_BITS)) return bucket;
+    unsigned exponent = (bucket >> PERF_SUB_BITS) + PERF_SUB_BITS - 1;
+    uint64_t mantissa = (1u << PERF_SUB_BITS) | (bucket & ((1u << PERF_SUB_BITS) - 1));
+    return mantissa << (exponent - PERF_SUB_BITS);
+}
+
+uint64_t perf_snapshot::samples(perf_histogram histogram) const {
+    uint64_t total = 0;
+    for (uint64_t count : buckets[histogram]) total += count;
+    return total;
+}
+
+uint64_t perf_snapshot::quantile(perf_histogram histogram, double q) const {
+    uint64_t total = samples(histogram);
+    if (total == 0) return 0;
+    uint64_t rank = (uint64_t) (q * (total - 1));
+    uint64_t seen = 0;
+    for (size_t b = 0; b < PERF_BUCKETS; b++) {
+        seen += buckets[histogram][b];
+        if (seen > rank) return perf_bucket_floor(b);
+    }
+    return perf_bucket_floor(PERF_BUCKETS - 1);
+}
+
+perf_snapshot perf_read() {
+    perf_snapshot snapshot;
+    memset(snapshot.counters, 0, sizeof(snapshot.counters));
+    for (std::vector<uint64_t>& buckets : snapshot.buckets) buckets.assign(PERF_BUCKETS, 0);
+
+    detail::perfRegistry& r = detail::registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    for (const detail::perfSlot* slot : r.slots) {
+        for (size_t c = 0; c < PERF_COUNTERS; c++) {
+            snapshot.counters[c] += slot->counters[c].load(std::memory_order_relaxed);
+        }
+        for (size_t h = 0; h < PERF_HISTOGRAMS; h++) {
+            for (size_t b = 0; b < PERF_BUCKETS; b++) {
+                snapshot.buckets[h][b] += slot->buckets[h][b].load(std::memory_order_relaxed);
+            }
+        }
+    }
+    return snapshot;
+}
+
+const char* perf_counter_name(perf_counter counter) {
+    static const char* names[PERF_COUNTERS] = {
+        "launches", "replays", "hashes", "solutions", "bad_nonces", "hash_batches", "hash_messages"
+    };
+    return names[counter];
+}
+
+const char* perf_histogram_name(perf_histogram histogram) {
+    static const char* names[PERF_HISTOGRAMS] = { "launch_ns", "gap_ns", "hash_batch_ns" };
+    return names[histogram];
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Process-wide counters and latency histograms for the hot paths: every
+// launch, hashing batch and search loop iteration of every engine feeds them.
+//
+// Each thread writes only to its own cache-line aligned slot, with relaxed
+// loads and stores rather than read-modify-write instructions, so updates
+// cost a few nanoseconds however many threads update at once. A reader sums
+// all slots, lazily, only when it asks (perf_read). Slots of threads that
+// have exited are handed to new threads with their counts, so nothing is lost
+// and the number of slots stays at the most threads alive at once.
+enum perf_counter {
+    PERF_LAUNCHES,         // search launches, on any engine; one split at 2^32 counts once
+    PERF_REPLAYS,          // of which replayed from a command buffer
+    PERF_HASHES,           // nonces searched
+    PERF_SOLUTIONS,        // verified nonces returned by run_search
+    PERF_BAD_NONCES,       // nonces that failed host verification
+    PERF_HASH_BATCHES,     // hash_messages calls
+    PERF_HASH_MESSAGES,    // messages hashed by them
+    PERF_COUNTERS
+};
+
+// Log-linear in nanoseconds: 8 buckets per power of two, so any value is
+// known to within 12.5%.
+enum perf_histogram {
+    PERF_LAUNCH_NS,        // host time of a blocking search launch
+    PERF_GAP_NS,           // host time between launches on one device
+    PERF_HASH_BATCH_NS,    // host time of a hash_messages call
+    PERF_HISTOGRAMS
+};
+
+const unsigned PERF_SUB_BITS = 3;
+const size_t PERF_BUCKETS = (64 - PERF_SUB_BITS + 1) << PERF_SUB_BITS;
+
+void perf_count(perf_counter counter, uint64_t n = 1);
+void perf_record(perf_histogram histogram, uint64_t ns);
+
+// The smallest value that falls into `bucket`, and the bucket of a value.
+uint64_t perf_bucket_floor(size_t bucket);
+size_t perf_bucket(uint64_t ns);
+
+struct perf_snapshot {
+    uint64_t counters[PERF_COUNTERS];
+    std::vector<uint64_t> buckets[PERF_HISTOGRAMS];
+
+    uint64_t samples(perf_histogram histogram) const;
+
+    // Lower bound of the bucket holding quantile `q` (0..1), 0 if empty.
+    uint64_t quantile(perf_histogram histogram, double q) const;
+};
+
+// Sums the slots of all threads. Updates made meanwhile may or may not be
+// included, each one entirely or not at all.
+perf_snapshot perf_read();
+
+const char* perf_counter_name(perf_counter counter);
+const char* perf_histogram_name(perf_histogram histogram);
@@ -0,0 +1,107 @@
+#include <cstdio>
+#include <cstdlib>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "common.h"
+#include "perf_stats.hpp"
+#include "search.hpp"
+
+search_result run_search(opencl_backend& backend, load_balancer& balancer, const search_job& job) {
+    nonce_coordinator* coordinator = job.coordinator;
+    bool quiet = job.quiet;
+
+    std::atomic<uint64_t> next_nonce(job.start_nonce);
+    std::atomic<uint64_t> hashes(0);
+    std::atomic<bool> done(false);
+    std::mutex found_mutex;
+    search_result result = { false, 0, 0, 0 };
+
+    // Every device runs its own search loop; the first verified nonce wins.
+    auto search = [&](size_t device) {
+        bool launched = false;
+        std::chrono::high_resolution_clock::time_point t_last;
+        while (!done) {
+            if (job.cancelled && job.cancelled()) {
+                done = true;
+                break;
+            }
+            backend.service_hashing(device, job.hash_share);
+
+            size_t launch_size = balancer.next_global_size(device);
+            uint64_t launch_nonces = launch_size * job.workset_size;
+            uint64_t candidate = 0;
+            uint64_t nonce = 0;
+            bool solved_elsewhere = false;
+            if (coordinator != nullptr && coordinator->solved(&candidate)) {
+                solved_elsewhere = true;
+                if (!quiet) fprintf(stderr, "Solved by another process: %#lx\n", candidate);
+            } else {
+                nonce = coordinator != nullptr
+                    ? coordinator->claim(launch_nonces)
+                    : next_nonce.fetch_add(launch_nonces);
+                if (!quiet) fprintf(stderr,
+                    "[%zu] Trying %#lx - %#lx\n", device, nonce, nonce + launch_nonces - 1);
+                auto t_launch = std::chrono::high_resolution_clock::now();
+                candidate = backend.continue_search(nonce, device, launch_size);
+                if (stray_solution(job.block_data, job.block_size, job.target_hash, candidate, nonce, launch_nonces)) {
+                    candidate = 0;
+                }
+                auto t_done = std::chrono::high_resolution_clock::now();
+                double launch_ms = std::chrono::duration<double, std::milli>(t_done - t_launch).count();
+                balancer.record(device, launch_nonces, launch_ms,
+                    launched ? std::chrono::duration<double, std::milli>(t_launch - t_last).count() : -1);
+                if (launched) {
+                    perf_record(PERF_GAP_NS, std::chrono::duration_cast<std::chrono::nanoseconds>(t_launch - t_last).count());
+                }
+                launched = true;
+                t_last = t_done;
+                hashes += launch_nonces;
+                if (coordinator != nullptr) coordinator->complete(nonce, launch_nonces);
+
+                // Co-tenant duty cycle: leave the device to others for a while.
+                double idle = balancer.idle_ms(launch_ms);
+                if (idle > 0 && candidate == 0) {
+                    std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(idle));
+                }
+            }
+
+            if (candidate == 0) continue;
+            if (!quiet) fprintf(stderr, "Done %#lx!\n", candidate);
+
+            if (!verify_nonce(job.block_data, job.block_size, job.target_hash, candidate)) {
+                fprintf(stderr, "Bad nonce!!!\n");
+                perf_count(PERF_BAD_NONCES);
+                if (!job.tolerate_bad_nonces || solved_elsewhere) exit(-1);
+                balancer.record_error(device);
+                continue;
+            }
+
+            std::lock_guard<std::mutex> lock(found_mutex);
+            if (!done) {
+                result.found = true;
+                result.nonce = candidate;
+                done = true;
+                perf_count(PERF_SOLUTIONS);
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (size_t device = 1; device < backend.devices.size(); device++) {
+        workers.push_back(std::thread(search, device));
+    }
+    search(0);
+    for (std::thread& worker : workers) worker.join();
+
+    if (coordinator != nullptr && result.found) {
+        coordinator->publish(result.nonce);
+    }
+
+    result.hashes = hashes;
+    result.next_nonce = next_nonce;
+    return result;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+#include "common.h"
+#include "load_balancer.hpp"
+#include "nonce_coordinator.hpp"
+#include "opencl_backend.hpp"
+
+struct search_job {
+    uint8_t* block_data;          // zero padded to 320 bytes
+    size_t block_size;
+    uint8_t* target_hash;
+    uint64_t start_nonce;
+    size_t workset_size;
+    nonce_coordinator* coordinator;  // optional, see -s
+    bool quiet;
+
+    // Polled between launches; a search stops once it returns true.
+    std::function<bool()> cancelled;
+
+    // Share of device time given to queued hashing jobs, see service_hashing.
+    double hash_share;
+
+    // Whether a nonce that fails verification is counted (load_balancer::
+    // record_error) and the search goes on, instead of the process exiting.
+    bool tolerate_bad_nonces;
+};
+
+struct search_result {
+    bool found;
+    uint64_t nonce;
+    uint64_t hashes;
+    uint64_t next_nonce;   // without a coordinator: everything before it was searched
+};
+
+// Searches on every device of `backend` until a verified nonce is found or
+// the job is cancelled. The backend must have a search kernel for the job.
+search_result run_search(opencl_backend& backend, load_balancer& balancer, const search_job& job);
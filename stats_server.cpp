@@ -0,0 +1,152 @@
+#include <cstdio>
+#include <cstring>
+#include <inttypes.h>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "perf_stats.hpp"
+#include "stats_server.hpp"
+#include "tuning_db.hpp"
+
+namespace detail {
+    const int STATS_TIMEOUT_MS = 2000;
+
+    void sendAll(int fd, const std::string& data) {
+        const char* p = data.data();
+        size_t left = data.size();
+        while (left > 0) {
+            ssize_t n = send(fd, p, left, MSG_NOSIGNAL);
+            if (n <= 0) return;
+            p += n;
+            left -= n;
+        }
+    }
+
+    // The process-wide counters and histograms of perf_stats.
+    std::string perfLines() {
+        perf_snapshot perf = perf_read();
+        std::string lines;
+        char line[256];
+        for (size_t c = 0; c < PERF_COUNTERS; c++) {
+            snprintf(line, sizeof(line), "counter %s %" PRIu64 "\n",
+                perf_counter_name((perf_counter) c), perf.counters[c]);
+            lines += line;
+        }
+        for (size_t h = 0; h < PERF_HISTOGRAMS; h++) {
+            perf_histogram histogram = (perf_histogram) h;
+            snprintf(line, sizeof(line), "histogram %s %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 "\n",
+                perf_histogram_name(histogram), perf.samples(histogram), perf.quantile(histogram, 0.5),
+                perf.quantile(histogram, 0.9), perf.quantile(histogram, 0.99), perf.quantile(histogram, 1));
+            lines += line;
+        }
+        return lines;
+    }
+
+    void answerScrape(int fd, const std::function<std::string()>& report) {
+        timeval tv = { STATS_TIMEOUT_MS / 1000, (STATS_TIMEOUT_MS % 1000) * 1000 };
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+        std::string request;
+        char chunk[1024];
+        ssize_t n;
+        while (request.find("\r\n\r\n") == std::string::npos && request.size() < 16 * 1024
+            && (n = recv(fd, chunk, sizeof(chunk), 0)) > 0) {
+            request.append(chunk, n);
+        }
+
+        std::string status = "200 OK";
+        std::string body;
+        if (request.compare(0, 11, "GET /stats ") == 0) {
+            body = report() + perfLines() + "end\n";
+        } else {
+            status = "404 Not Found";
+            body = "only GET /stats\n";
+        }
+        sendAll(fd,
+            "HTTP/1.1 " + status + "\r\n"
+            "Content-Type: text/plain\r\n"
+            "Content-Length: " + std::to_string(body.size()) + "\r\n"
+            "Connection: close\r\n\r\n" + body);
+    }
+};
+
+void append_device_stats(
+    std::string& report, int platform, const std::vector<int>& device_ids,
+    opencl_backend& backend, load_balancer& balancer, size_t workset_size
+) {
+    std::vector<device_health> health = balancer.snapshot();
+    std::map<std::string, tuning_entry> tuned;
+    std::map<std::string, bool> driver_changed;
+    for (size_t d = 0; d < backend.devices.size() && d < health.size(); d++) {
+        const std::string& key = backend.devices[d].build_key;
+        if (tuned.find(key) == tuned.end()) {
+            tuning_entry entry;
+            bool changed = false;
+            if (!load_tuning_baseline(tuning_db_path(), key, entry, changed)) entry = { key, "-", 0, 0, 0, 0, 0 };
+            tuned[key] = entry;
+            driver_changed[key] = changed;
+        }
+        const tuning_entry& entry = tuned[key];
+        const device_health& h = health[d];
+
+        char line[256];
+        snprintf(line, sizeof(line),
+            "device %d.%d %s %zu %zu %zu %" PRIu64 " %.0f %.3f %.3f %" PRIu64 " %d %.0f %s %zu %d ",
+            platform < 0 ? 0 : platform, d < device_ids.size() ? device_ids[d] : (int) d, backend.kernel_variant.c_str(),
+            h.launch_size, workset_size, h.samples, h.hashes, h.rate * 1000, h.launch_ms,
+            h.max_launch_ms, h.errors, h.throttled ? 1 : 0,
+            entry.hashrate, entry.variant.c_str(), entry.global_size, driver_changed[key] ? 1 : 0);
+        report += line + key + "\n";
+    }
+}
+
+int listen_stats(const std::string& address) {
+    size_t colon = address.rfind(':');
+    std::string host = colon == std::string::npos ? "" : address.substr(0, colon);
+    std::string port = colon == std::string::npos ? address : address.substr(colon + 1);
+
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    addrinfo* result = nullptr;
+    if (getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &result) != 0) return -1;
+
+    int fd = -1;
+    for (addrinfo* ai = result; ai != nullptr && fd < 0; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) continue;
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+#ifdef SO_REUSEPORT
+        // A chungusd started with -R binds next to the one it replaces.
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+#endif
+        if (bind(fd, ai->ai_addr, ai->ai_addrlen) != 0 || listen(fd, 16) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(result);
+    return fd;
+}
+
+void serve_stats(int listener, std::function<std::string()> report) {
+    // Scrapes are rare and quick; one at a time is plenty.
+    std::thread([listener, report]() {
+        while (true) {
+            int fd = accept(listener, nullptr, nullptr);
+            if (fd < 0) continue;
+            detail::answerScrape(fd, report);
+            close(fd);
+        }
+    }).detach();
+}
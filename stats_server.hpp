@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "load_balancer.hpp"
+#include "opencl_backend.hpp"
+
+// Live device statistics of a running miner (chungusd, chungus-native),
+// served over plain HTTP for chungus-farm and anything else that scrapes:
+//
+//   GET /stats -> text/plain, one line per device, the perf_stats lines below,
+//                 then `end`:
+//     device <platform>.<device> <variant> <launch size> <workset> <launches>
+//            <hashes> <rate> <launch ms> <max launch ms> <errors> <throttled>
+//            <tuned rate> <tuned variant> <tuned global> <driver changed>
+//            <build key>
+//
+// Rates are in H/s; the rate and launch ms are the load balancer's moving
+// averages. The tuned fields are this rig's tuning database entry for the
+// build key (chungus-bench -A), `0 - 0` without one. After a driver update
+// they come from the latest entry for the same device name and <driver
+// changed> is 1. The build key, which may contain spaces, takes the rest of
+// the line.
+//
+// The device lines are followed by the process-wide perf_stats:
+//     counter <name> <value>
+//     histogram <name> <samples> <p50> <p90> <p99> <max>
+// with histogram values in nanoseconds, each the lower bound of its bucket.
+
+// Appends the lines of every device of `backend`; device i is the OpenCL
+// device `device_ids[i]` of `platform` (-1 for the default, 0).
+void append_device_stats(
+    std::string& report, int platform, const std::vector<int>& device_ids,
+    opencl_backend& backend, load_balancer& balancer, size_t workset_size);
+
+// Listens for scrapes on `address`, `[host:]port`, all interfaces without a
+// host. Returns -1 on failure.
+int listen_stats(const std::string& address);
+
+// Answers every request on `listener` with what `report` returns, from a
+// thread of its own, for as long as the process runs.
+void serve_stats(int listener, std::function<std::string()> report);
@@ -0,0 +1,79 @@
+#!/usr/bin/env python3
+"""Generates the time-to-solution corpus that replay-corpus.py replays.
+
+Each line holds a header, a target, a start nonce, the first nonce at or after
+the start that meets the target, and the distance between the two, found with
+chungus-cpu. The headers are test/header.bin with a different creation time
+each and the start nonces come from a fixed seed, so the corpus only depends on
+the arguments. The first start nonce sits just below a multiple of 2^32. So
+does the second, unaligned and right after a solution to the second target, so
+that a miner which splits its first launch at 2^32 and searches from a little
+before the start must not report that solution.
+
+    test/make-corpus.py -n 8 -b 16,20,24,28 -o test/corpus.txt
+"""
+import argparse
+import os
+import random
+import struct
+import subprocess
+import sys
+
+MYDIR = os.path.dirname(os.path.realpath(__file__))
+
+
+def target_hex(bits):
+    # Targets are little endian 256-bit numbers.
+    return (2**(256 - bits) - 1).to_bytes(32, 'little').hex()
+
+
+def first_solution(cpu, header, target, start):
+    result = subprocess.run([cpu, '-n', '%016x' % start, target],
+                            input=bytes(header), stdout=subprocess.PIPE, check=True)
+    return int(result.stdout.split()[0], 16)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Generate a time-to-solution corpus with chungus-cpu.')
+    parser.add_argument('-n', '--headers', type=int, default=8, help='number of headers (default 8)')
+    parser.add_argument('-b', '--bits', default='16,20,24,28',
+                        help='target difficulties in bits (default 16,20,24,28)')
+    parser.add_argument('-s', '--seed', type=int, default=1, help='seed for the start nonces (default 1)')
+    parser.add_argument('-o', '--output', default=os.path.join(MYDIR, 'corpus.txt'))
+    parser.add_argument('--cpu', default=os.path.join(MYDIR, '..', 'chungus-cpu'), help='chungus-cpu binary')
+    args = parser.parse_args()
+
+    base = open(os.path.join(MYDIR, 'header.bin'), 'rb').read()
+    (creation_time,) = struct.unpack_from('<Q', base, 8)
+    rng = random.Random(args.seed)
+    bits = [int(b) for b in args.bits.split(',')]
+
+    with open(args.output, 'w') as out:
+        out.write('# Generated by test/make-corpus.py -n %d -b %s -s %d\n' % (args.headers, args.bits, args.seed))
+        out.write('# header target start_nonce first_solution distance\n')
+        for i in range(args.headers):
+            header = bytearray(base)
+            struct.pack_into('<Q', header, 8, creation_time + i * 1000000)
+            start = rng.getrandbits(64)
+            if i == 0:
+                start = (start & ~0xffffffff) | 0xffff0000
+            if i == 1:
+                hard = target_hex(bits[min(1, len(bits) - 1)])
+                while True:
+                    boundary = (start | 0xffffffff) + 1
+                    solution = first_solution(args.cpu, header, hard, boundary - 2**18)
+                    if solution < boundary and solution % 64 != 63:
+                        break
+                    start += 2**32
+                start = solution + 1
+            for b in bits:
+                target = target_hex(b)
+                solution = first_solution(args.cpu, header, target, start)
+                distance = (solution - start) % 2**64
+                out.write('%s %s %016x %016x %d\n' % (header.hex(), target, start, solution, distance))
+                out.flush()
+                print('header %d, %d bits: distance %d' % (i, b, distance), file=sys.stderr)
+
+
+if __name__ == '__main__':
+    main()
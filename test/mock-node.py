@@ -0,0 +1,58 @@
+# Stand-in for a chainweb node's mining API, for testing chungus-native.
+#
+#   python3 test/mock-node.py <port> [<delay ms>] [<age ms>]
+#
+# Serves test/header.bin as work with an easy target. <delay ms> is added to
+# every response, and the served header is backdated by <age ms>. Submitted
+# solutions are checked and logged to stdout. A new parent appears every two
+# seconds, <age ms> later on slower nodes, like blocks propagating.
+
+import hashlib
+import os
+import struct
+import sys
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+MYDIR = os.path.dirname(os.path.realpath(__file__))
+HEADER = open(os.path.join(MYDIR, 'header.bin'), 'rb').read()
+TARGET = bytes(28) + b'\xff\xff\x00\x00'   # little endian, about 2^16 hashes per solution
+
+port = int(sys.argv[1])
+delay = float(sys.argv[2]) / 1000 if len(sys.argv) > 2 else 0
+age = int(sys.argv[3]) if len(sys.argv) > 3 else 0
+
+
+def height():
+    # A new parent every two seconds on every mock node alike.
+    return int((time.time() - age / 1000) / 2)
+
+
+class Handler(BaseHTTPRequestHandler):
+    def log_message(self, *args):
+        pass
+
+    def do_POST(self):
+        body = self.rfile.read(int(self.headers.get('Content-Length', 0)))
+        time.sleep(delay)
+        if self.path.endswith('/mining/work'):
+            now = int(time.time() * 1e6) - age * 1000
+            header = HEADER[:8] + struct.pack('<Q', now) + struct.pack('<Q', height()) + HEADER[24:]
+            self.reply(200, struct.pack('<I', 0) + TARGET + header)
+        elif self.path.endswith('/mining/solved'):
+            digest = hashlib.blake2s(body).digest()
+            ok = len(body) == len(HEADER) and \
+                int.from_bytes(digest, 'little') <= int.from_bytes(TARGET, 'little')
+            print('solved %s nonce=%s' % ('ok' if ok else 'BAD', body[:8].hex()), flush=True)
+            self.reply(204 if ok else 400, b'')
+        else:
+            self.reply(404, b'')
+
+    def reply(self, status, payload):
+        self.send_response(status)
+        self.send_header('Content-Length', str(len(payload)))
+        self.end_headers()
+        self.wfile.write(payload)
+
+
+ThreadingHTTPServer(('127.0.0.1', port), Handler).serve_forever()
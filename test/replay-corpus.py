@@ -0,0 +1,93 @@
+#!/usr/bin/env python3
+"""Replays the time-to-solution corpus against a miner.
+
+Every corpus entry is run as a fresh miner process with the entry's fixed start
+nonce (-n), so each measured time includes startup and covers the same number
+of hashes on every run. Everything after `--` is the miner command line:
+
+    test/replay-corpus.py -r 3 -- ./bigolchungus -d 0 -k kernels/kernel.cl
+    test/replay-corpus.py -- ./chungus-client -V tuned
+
+The per entry time is the median of the -r runs. The summary gives, for each
+target, the mean time to solution and the rate at which the miner covered the
+distances, and the total over the corpus, which is the number to compare
+between builds and devices.
+"""
+import argparse
+import os
+import statistics
+import subprocess
+import sys
+import time
+
+MYDIR = os.path.dirname(os.path.realpath(__file__))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Replay the time-to-solution corpus against a miner.')
+    parser.add_argument('-c', '--corpus', default=os.path.join(MYDIR, 'corpus.txt'))
+    parser.add_argument('-r', '--repeat', type=int, default=1, help='runs per entry (default 1)')
+    parser.add_argument('-o', '--csv', help='write the per entry times to this file')
+    parser.add_argument('miner', nargs=argparse.REMAINDER,
+                        help='miner command (default: bigolchungus with kernels/kernel.cl)')
+    args = parser.parse_args()
+
+    miner = args.miner[1:] if args.miner[:1] == ['--'] else args.miner
+    if not miner:
+        miner = [os.path.join(MYDIR, '..', 'bigolchungus'), '-k', os.path.join(MYDIR, '..', 'kernels', 'kernel.cl')]
+
+    entries = []
+    for line in open(args.corpus):
+        if line.startswith('#') or not line.strip():
+            continue
+        header, target, start, solution, distance = line.split()
+        entries.append((bytes.fromhex(header), target, int(start, 16), int(solution, 16), int(distance)))
+
+    csv = open(args.csv, 'w') if args.csv else None
+    if csv:
+        csv.write('miner,entry,target,distance,found_distance,seconds\n')
+
+    by_target = {}
+    for k, (header, target, start, solution, distance) in enumerate(entries):
+        times = []
+        for _ in range(args.repeat):
+            t_start = time.monotonic()
+            result = subprocess.run(miner + ['-n', '%016x' % start, target], input=header,
+                                    stdout=subprocess.PIPE, stderr=subprocess.DEVNULL)
+            times.append(time.monotonic() - t_start)
+            if result.returncode != 0:
+                print('entry %d: miner failed with status %d' % (k, result.returncode), file=sys.stderr)
+                sys.exit(1)
+            # Miners check their solutions, so one before the recorded first
+            # solution means the corpus does not match this header encoding.
+            found = (int(result.stdout.split()[0], 16) - start) % 2**64
+            if found >= 2**63:
+                print('entry %d: found a solution %d nonces before the start'
+                      % (k, 2**64 - found), file=sys.stderr)
+                sys.exit(1)
+            if found < distance:
+                print('entry %d: found a solution at distance %d, before the first one at %d'
+                      % (k, found, distance), file=sys.stderr)
+                sys.exit(1)
+
+        seconds = statistics.median(times)
+        by_target.setdefault(target, []).append((distance, seconds))
+        print('entry %3d  %s  distance %12d  %8.3f s' % (k, target[-16:], distance, seconds))
+        if csv:
+            csv.write('"%s",%d,%s,%d,%d,%.4f\n' % (' '.join(miner), k, target, distance, found, seconds))
+    if csv:
+        csv.close()
+
+    print('%-16s %8s %12s %12s %12s' % ('target', 'entries', 'mean s', 'median s', 'MH/s'))
+    total = 0
+    for target, runs in by_target.items():
+        seconds = [s for _, s in runs]
+        total += sum(seconds)
+        rate = sum(d for d, _ in runs) / sum(seconds) / 1e6
+        print('%-16s %8d %12.3f %12.3f %12.2f' % (target[-16:], len(runs), statistics.mean(seconds),
+                                                  statistics.median(seconds), rate))
+    print('total %.3f s over %d entries' % (total, len(entries)))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,79 @@
+#!/bin/bash
+# Builds chungus-cpu, which needs no OpenCL runtime, and checks its search and
+# hash modes against the host reference.
+MYDIR="$(dirname "$(realpath "$0")")"
+cmake $MYDIR/../ > /dev/null || exit 1
+make -C $MYDIR/../ chungus-cpu > /dev/null || exit 1
+BUILD="$MYDIR/.."
+
+# chungus-cpu checks every nonce it finds on the host and fails on a bad one.
+for NONCE in 0123456789abcdef 00000001ffffff00 ffffffffffffff00; do
+  RESULT=$(cat "$MYDIR/header.bin" | "$BUILD/chungus-cpu" -n $NONCE \
+    ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff0000) || exit 1
+  echo "-n $NONCE: $RESULT"
+done
+
+MESSAGES=$(mktemp)
+FIXED=$(mktemp)
+trap "rm -f $MESSAGES $FIXED" EXIT
+
+# The fixed-block Blake2s that verify_nonce uses, against the reference, at
+# every length around and across the block boundaries; both from the start of
+# the message and, as verify_nonce does, with its first 8 bytes split off.
+cc -O2 -I"$MYDIR/.." -o "$FIXED" -x c - "$MYDIR/../blake2s_ref.c" <<'EOF' || exit 1
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "blake2s_ref.h"
+
+int main(void) {
+  int failed = 0;
+  for (size_t len = 0; len <= 700; len++) {
+    /* Exactly len bytes, so that reading past the message would show. */
+    uint8_t* in = malloc(len + 1);
+    uint8_t expected[32], fixed[32], split[32];
+    for (size_t i = 0; i < len; i++) in[i] = (uint8_t) (i * 131 + len);
+    blake2s(expected, 32, in, len, NULL, 0);
+    blake2s_fixed(fixed, in, len);
+    if (memcmp(expected, fixed, 32) != 0) {
+      printf("blake2s_fixed differs at length %zu\n", len);
+      failed = 1;
+    }
+    if (len > BLAKE2S_BLOCKBYTES) {
+      size_t tail = (len - 1) % BLAKE2S_BLOCKBYTES + 1;
+      blake2s_fixed_state state = blake2s_fixed_initial;
+      blake2s_fixed_head_block(&state, in, in + 8);
+      blake2s_fixed_blocks(&state, in + BLAKE2S_BLOCKBYTES, len - BLAKE2S_BLOCKBYTES - tail);
+      blake2s_fixed_final(&state, in + len - tail, tail, split);
+      if (memcmp(expected, split, 32) != 0) {
+        printf("blake2s_fixed_head_block differs at length %zu\n", len);
+        failed = 1;
+      }
+    }
+    free(in);
+  }
+  return failed;
+}
+EOF
+if "$FIXED"; then
+  echo "fixed-block blake2s ok"
+else
+  echo "fixed-block blake2s mismatch"
+  exit 1
+fi
+
+for LEN in 0 1 63 64 65 286 1000; do
+  head -c $LEN /dev/urandom | od -An -v -tx1 | tr -d ' \n'
+  echo
+done > "$MESSAGES"
+
+if diff <("$BUILD/chungus-cpu" -H < "$MESSAGES") \
+        <(python3 -c "
+import hashlib, sys
+for line in open(sys.argv[1]):
+    print(hashlib.blake2s(bytes.fromhex(line.strip())).hexdigest())" "$MESSAGES"); then
+  echo "hash mode ok"
+else
+  echo "hash mode mismatch"
+  exit 1
+fi
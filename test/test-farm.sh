@@ -0,0 +1,61 @@
+#!/bin/bash
+# Runs chungus-farm against stand-in rigs that serve canned /stats replies,
+# and checks that it ranks the underperforming devices worst first.
+MYDIR="$(dirname "$(realpath "$0")")"
+cmake $MYDIR/../ > /dev/null || exit 1
+make -C $MYDIR/../ chungus-farm > /dev/null || exit 1
+
+RIGS=$(mktemp -d)
+PIDS=""
+trap 'kill $PIDS 2> /dev/null; rm -r $RIGS' EXIT
+
+# device <id> <variant> <launch size> <workset> <launches> <hashes> <rate H/s>
+#        <launch ms> <max launch ms> <errors> <throttled> <tuned rate H/s>
+#        <tuned variant> <tuned global> <driver changed> <build key>
+stand_in() {
+  mkdir -p $RIGS/$1
+  cat > $RIGS/$1/stats
+  python3 -m http.server $1 --bind 127.0.0.1 --directory $RIGS/$1 > /dev/null 2>&1 &
+  PIDS="$PIDS $!"
+}
+
+# Healthy, and a device without a tuning entry.
+stand_in 18201 <<EOF
+device 0.0 unrolled 1048576 64 500 33554432000 1000000000 67.1 70.2 0 0 1010000000 unrolled 1048576 0 GPU A|2.0|510
+device 0.1 compact 1048576 64 500 33554432000 500000000 134.2 140.0 0 0 0 - 0 0 GPU B|2.0|510
+end
+EOF
+# A card at 70% of its baseline, and one throttling at 88%.
+stand_in 18202 <<EOF
+device 0.0 unrolled 1048576 64 500 33554432000 700000000 95.9 99.0 0 0 1000000000 unrolled 1048576 0 GPU A|2.0|510
+device 0.1 unrolled 1048576 64 500 33554432000 880000000 76.3 80.0 0 1 1000000000 unrolled 1048576 0 GPU A|2.0|510
+end
+EOF
+# A regressed driver returning bad nonces, at full speed, held to the entry
+# tuned under the previous driver.
+stand_in 18203 <<EOF
+device 0.0 unrolled 1048576 64 500 33554432000 990000000 67.8 70.0 3 0 1000000000 unrolled 1048576 1 GPU A|2.1|520
+end
+EOF
+sleep 1
+
+# 18209 has no rig behind it.
+REPORT=$($MYDIR/../chungus-farm 127.0.0.1:18201 127.0.0.1:18202 127.0.0.1:18203 127.0.0.1:18209)
+STATUS=$?
+echo "$REPORT"
+
+EXPECTED="127.0.0.1:18209 -
+127.0.0.1:18203 0.0
+127.0.0.1:18202 0.1
+127.0.0.1:18202 0.0"
+RANKED=$(echo "$REPORT" | awk 'NR > 1 { print $2, $3 }')
+if [ "$STATUS" -ne 2 ] || [ "$RANKED" != "$EXPECTED" ]; then
+  echo "unexpected ranking (exit status $STATUS), wanted:"
+  echo "$EXPECTED"
+  exit 1
+fi
+if ! echo "$REPORT" | grep -q "127.0.0.1:18203 .*driver changed"; then
+  echo "the driver update of 127.0.0.1:18203 was not flagged"
+  exit 1
+fi
+echo "ranking ok"
@@ -0,0 +1,33 @@
+#!/bin/bash
+# Runs chungus-native against three local mock nodes with different response
+# delays and work ages, and checks that every node received valid solutions.
+
+MYDIR="$(dirname "$(realpath "$0")")"
+cmake $MYDIR/../
+make -C $MYDIR/../
+
+LOG_DIR=$(mktemp -d)
+PIDS=""
+NODES=""
+for spec in "18101 0 0" "18102 50 500" "18103 200 2000"; do
+  set -- $spec
+  python3 $MYDIR/mock-node.py $1 $2 $3 > $LOG_DIR/node-$1.log &
+  PIDS="$PIDS $!"
+  NODES="$NODES -N 127.0.0.1:$1"
+done
+sleep 1
+
+timeout ${1:-20} $MYDIR/../chungus-native $NODES \
+  -a test-account -K test-key -i 200 -g 65536 \
+  -k $MYDIR/../kernels/kernel.cl ${@:2}
+
+kill $PIDS
+EXIT_CODE=0
+for log in $LOG_DIR/*.log; do
+  OK=$(grep -c 'solved ok' $log)
+  BAD=$(grep -c 'solved BAD' $log)
+  echo "$(basename $log): $OK valid, $BAD invalid solution(s)"
+  if [ "$OK" -eq 0 ] || [ "$BAD" -ne 0 ]; then EXIT_CODE=1; fi
+done
+rm -r $LOG_DIR
+exit $EXIT_CODE
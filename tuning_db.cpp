@@ -0,0 +1,125 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+
+#include "tuning_db.hpp"
+
+namespace detail {
+    bool parseEntry(const std::string& line, tuning_entry& entry) {
+        if (line.empty() || line[0] == '#') return false;
+        size_t tab = line.find('\t');
+        if (tab == std::string::npos) return false;
+        entry.device = line.substr(0, tab);
+        std::istringstream fields(line.substr(tab + 1));
+        fields >> entry.variant >> entry.local_size >> entry.workset_size
+               >> entry.global_size >> entry.hashrate >> entry.compile_ms;
+        return !fields.fail();
+    }
+
+    std::string formatEntry(const tuning_entry& entry) {
+        std::ostringstream ss;
+        ss << entry.device << "\t" << entry.variant << "\t" << entry.local_size
+           << "\t" << entry.workset_size << "\t" << entry.global_size
+           << "\t" << (uint64_t) entry.hashrate << "\t" << entry.compile_ms;
+        return ss.str();
+    }
+};
+
+std::string tuning_db_path() {
+    const char* path = getenv("BIGOLCHUNGUS_TUNING_DB");
+    if (path != nullptr && path[0] != '\0') return path;
+    const char* home = getenv("HOME");
+    return std::string(home != nullptr ? home : ".") + "/.cache/bigolchungus/tuning.db";
+}
+
+bool load_tuning_entry(const std::string& path, const std::string& device, tuning_entry& entry) {
+    std::ifstream in(path.c_str());
+    std::string line;
+    while (std::getline(in, line)) {
+        if (detail::parseEntry(line, entry) && entry.device == device) return true;
+    }
+    return false;
+}
+
+bool load_tuning_baseline(
+    const std::string& path, const std::string& device, tuning_entry& entry, bool& driver_changed
+) {
+    driver_changed = false;
+    std::string name = device.substr(0, device.find('|'));
+    bool found = false;
+    std::ifstream in(path.c_str());
+    std::string line;
+    tuning_entry candidate;
+    while (std::getline(in, line)) {
+        if (!detail::parseEntry(line, candidate)) continue;
+        if (candidate.device == device) {
+            entry = candidate;
+            driver_changed = false;
+            return true;
+        }
+        // store_tuning_entry appends, so the last match is the most recent.
+        if (candidate.device.substr(0, candidate.device.find('|')) == name) {
+            entry = candidate;
+            driver_changed = true;
+            found = true;
+        }
+    }
+    return found;
+}
+
+bool store_tuning_entry(const std::string& path, const tuning_entry& entry) {
+    std::vector<std::string> lines;
+    {
+        std::ifstream in(path.c_str());
+        std::string line;
+        tuning_entry other;
+        while (std::getline(in, line)) {
+            if (detail::parseEntry(line, other) && other.device == entry.device) continue;
+            lines.push_back(line);
+        }
+    }
+    lines.push_back(detail::formatEntry(entry));
+
+    // Create the parent directories of the default location.
+    for (size_t slash = path.find('/', 1); slash != std::string::npos; slash = path.find('/', slash + 1)) {
+        mkdir(path.substr(0, slash).c_str(), 0755);
+    }
+
+    // Replace the file atomically so that a concurrent reader never sees half of it.
+    std::string tmp = path + ".tmp";
+    {
+        std::ofstream out(tmp.c_str());
+        for (const std::string& line : lines) out << line << "\n";
+        if (!out) return false;
+    }
+    return rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+void apply_tuning(
+    const std::string& device, bool quiet, std::string& variant,
+    size_t& local_size, size_t& workset_size, size_t& global_size
+) {
+    if (variant != "tuned") return;
+
+    tuning_entry entry;
+    if (!load_tuning_entry(tuning_db_path(), device, entry)) {
+        std::cerr << "No tuning entry for " << device << ", using the unrolled kernel" << std::endl;
+        variant = "unrolled";
+        return;
+    }
+
+    variant = entry.variant;
+    local_size = entry.local_size;
+    workset_size = entry.workset_size;
+    global_size = entry.global_size;
+    if (!quiet) {
+        std::cerr << "Tuned: " << variant << " kernel, -l " << local_size << " -w " << workset_size
+                  << " -g " << global_size << " (" << entry.hashrate / 1e6 << " MH/s when tuned)" << std::endl;
+    }
+}
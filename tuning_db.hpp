@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// Best known search kernel settings per device model, written by
+// chungus-bench -A and read back by `-V tuned`.
+//
+// One line per device model, tab separated:
+//   <build key> <variant> <local> <workset> <global> <hashrate> <compile ms>
+// The build key is the one identical devices share compiled programs under.
+struct tuning_entry {
+    std::string device;
+    std::string variant;
+    size_t local_size;
+    size_t workset_size;
+    size_t global_size;
+    double hashrate;
+    double compile_ms;
+};
+
+// $BIGOLCHUNGUS_TUNING_DB, or ~/.cache/bigolchungus/tuning.db.
+std::string tuning_db_path();
+
+bool load_tuning_entry(const std::string& path, const std::string& device, tuning_entry& entry);
+
+// The baseline to hold a running device to: its own entry, or else the most
+// recently stored one for the same device name (the build key up to its
+// first `|`), i.e. from before a driver update, with `driver_changed` set.
+bool load_tuning_baseline(
+    const std::string& path, const std::string& device, tuning_entry& entry, bool& driver_changed);
+
+// Replaces the entry for entry.device and keeps every other line.
+bool store_tuning_entry(const std::string& path, const tuning_entry& entry);
+
+// Resolves the `tuned` variant for `device` into the variant and work sizes of
+// its entry. Devices without an entry fall back to `unrolled` with the sizes
+// given. Any other variant is left alone.
+void apply_tuning(
+    const std::string& device, bool quiet, std::string& variant,
+    size_t& local_size, size_t& workset_size, size_t& global_size);